@@ -0,0 +1,17 @@
+/*
+ *     host/avr/interrupt.h
+ *
+ *          Project:  UART for ATmega4808
+ *          Author:   Hans-Henrik Fuxelius   
+ *          Date:     2023-05-08           
+ *
+ *  Vectors become plain functions that the simulator calls; the global
+ *  interrupt flag lives in the simulated SREG.
+ */
+
+#pragma once
+#include <avr/io.h>
+
+#define ISR(vector, ...)  void vector(void); void vector(void)
+#define sei()             (SREG |= CPU_I_bm)
+#define cli()             (SREG &= (uint8_t)~CPU_I_bm)
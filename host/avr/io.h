@@ -0,0 +1,159 @@
+/*
+ *     host/avr/io.h
+ *
+ *          Project:  UART for ATmega4808
+ *          Author:   Hans-Henrik Fuxelius   
+ *          Date:     2023-05-08           
+ *
+ *  Host stand-in for <avr/io.h>: the ATmega4809 registers uart.c touches, as
+ *  plain memory. Accesses with side effects are routed to the simulator in
+ *  sim.c through the hooks uart.c provides.
+ */
+
+#pragma once
+#include <stdint.h>
+
+typedef volatile uint8_t  register8_t;
+typedef volatile uint16_t register16_t;
+
+typedef struct {
+    register8_t  RXDATAL;
+    register8_t  RXDATAH;
+    register8_t  TXDATAL;
+    register8_t  TXDATAH;
+    register8_t  STATUS;
+    register8_t  CTRLA;
+    register8_t  CTRLB;
+    register8_t  CTRLC;
+    register16_t BAUD;
+    register8_t  CTRLD;
+    register8_t  DBGCTRL;
+    register8_t  EVCTRL;
+    register8_t  TXPLCTRL;
+    register8_t  RXPLCTRL;
+} USART_t;
+
+typedef struct {
+    register8_t  DIR, DIRSET, DIRCLR, DIRTGL;
+    register8_t  OUT, OUTSET, OUTCLR, OUTTGL;
+    register8_t  IN, INTFLAGS, PORTCTRL;
+} PORT_t;
+
+typedef struct {
+    register8_t  CTRLA, CTRLB, EVCTRL, INTCTRL, INTFLAGS, STATUS, DBGCTRL, TEMP;
+    register16_t CNT, CCMP;
+} TCB_t;
+
+typedef struct {
+    register8_t  CTRLA, STATUS, INTCTRL, INTFLAGS, TEMP, DBGCTRL, CLKSEL;
+    register16_t CNT, PER, CMP;
+} RTC_t;
+
+typedef struct {
+    register8_t  CTRLA;
+} SLPCTRL_t;
+
+typedef struct {
+    register8_t  EVSYSROUTEA, CCLROUTEA, USARTROUTEA, TWISPIROUTEA, TCAROUTEA, TCBROUTEA;
+} PORTMUX_t;
+
+extern USART_t   USART0, USART1, USART2, USART3, USART4, USART5;
+extern PORT_t    PORTA, PORTB, PORTC, PORTD, PORTE, PORTF, PORTG;
+extern TCB_t     TCB0, TCB1, TCB2, TCB3;
+extern RTC_t     RTC;
+extern SLPCTRL_t SLPCTRL;
+extern PORTMUX_t PORTMUX;
+extern __thread uint8_t SREG;                // Per thread, see sim.h
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// BIT MASKS & GROUP CONFIGURATIONS
+#define CPU_I_bm                  0x80
+
+#define PIN0_bm                   0x01
+#define PIN1_bm                   0x02
+#define PIN2_bm                   0x04
+#define PIN3_bm                   0x08
+#define PIN4_bm                   0x10
+#define PIN5_bm                   0x20
+#define PIN6_bm                   0x40
+#define PIN7_bm                   0x80
+
+#define USART_RXCIF_bm            0x80        // RXDATAH and STATUS
+#define USART_BUFOVF_bm           0x40
+#define USART_FERR_bm             0x04
+#define USART_PERR_bm             0x02
+#define USART_DATA8_bm            0x01
+
+#define USART_TXCIF_bm            0x40        // STATUS
+#define USART_DREIF_bm            0x20
+#define USART_RXSIF_bm            0x10
+#define USART_ISFIF_bm            0x08
+#define USART_BDF_bm              0x02
+#define USART_WFB_bm              0x01
+
+#define USART_RXCIE_bm            0x80        // CTRLA
+#define USART_TXCIE_bm            0x40
+#define USART_DREIE_bm            0x20
+#define USART_RXSIE_bm            0x10
+#define USART_LBME_bm             0x08
+#define USART_ABEIE_bm            0x04
+#define USART_RS485_gm            0x03
+#define USART_RS485_OFF_gc        0x00
+#define USART_RS485_EXT_gc        0x01
+#define USART_RS485_INT_gc        0x02
+
+#define USART_RXEN_bm             0x80        // CTRLB
+#define USART_TXEN_bm             0x40
+#define USART_SFDEN_bm            0x10
+#define USART_ODME_bm             0x08
+#define USART_RXMODE_gm           0x06
+#define USART_RXMODE_NORMAL_gc    0x00
+#define USART_RXMODE_CLK2X_gc     0x02
+#define USART_RXMODE_GENAUTO_gc   0x04
+#define USART_RXMODE_LINAUTO_gc   0x06
+#define USART_MPCM_bm             0x01
+
+#define USART_CMODE_ASYNCHRONOUS_gc  0x00     // CTRLC
+#define USART_PMODE_gm            0x30
+#define USART_PMODE_DISABLED_gc   0x00
+#define USART_PMODE_EVEN_gc       0x20
+#define USART_PMODE_ODD_gc        0x30
+#define USART_SBMODE_bm           0x08
+#define USART_SBMODE_1BIT_gc      0x00
+#define USART_SBMODE_2BIT_gc      0x08
+#define USART_CHSIZE_gm           0x07
+#define USART_CHSIZE_5BIT_gc      0x00
+#define USART_CHSIZE_6BIT_gc      0x01
+#define USART_CHSIZE_7BIT_gc      0x02
+#define USART_CHSIZE_8BIT_gc      0x03
+#define USART_CHSIZE_9BITL_gc     0x06
+#define USART_CHSIZE_9BITH_gc     0x07
+
+#define TCB_ENABLE_bm             0x01
+#define TCB_RUNSTDBY_bm           0x40
+#define TCB_CLKSEL_gm             0x06
+#define TCB_CLKSEL_CLKDIV1_gc     0x00
+#define TCB_CLKSEL_CLKDIV2_gc     0x02
+#define TCB_CNTMODE_INT_gc        0x00
+#define TCB_CNTMODE_TIMEOUT_gc    0x01
+#define TCB_CAPT_bm               0x01
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// DRIVER HOOKS; see REGISTER ACCESS & WAITING in uart.c
+uint8_t sim_usart_read_rxdatal(USART_t* usart);
+void    sim_usart_write_txdatal(USART_t* usart, uint8_t data);
+void    sim_usart_write_txdatah(USART_t* usart, uint8_t data);
+void    sim_usart_write_status(USART_t* usart, uint8_t bm);
+void    sim_tcb_write_intflags(TCB_t* tcb, uint8_t bm);
+uint8_t sim_pin_read(PORT_t* port);
+void    sim_wait(void);
+void    sim_poll(void);
+
+#define USART_RXDATAL_READ(usart)          sim_usart_read_rxdatal(usart)
+#define USART_TXDATAL_WRITE(usart, data)   sim_usart_write_txdatal(usart, (uint8_t)(data))
+#define USART_TXDATAH_WRITE(usart, data)   sim_usart_write_txdatah(usart, (uint8_t)(data))
+#define USART_STATUS_WRITE(usart, bm)      sim_usart_write_status(usart, (uint8_t)(bm))
+#define USART_INTFLAGS_WRITE(tcb, bm)      sim_tcb_write_intflags(tcb, (uint8_t)(bm))
+#define USART_PIN_READ(port)               sim_pin_read(port)
+#define USART_WAIT_WHILE(cond)             while (cond) sim_wait()
+#define USART_POLL_WHILE(cond)             while (cond) sim_poll()
@@ -0,0 +1,17 @@
+/*
+ *     host/avr/pgmspace.h
+ *
+ *          Project:  UART for ATmega4808
+ *          Author:   Hans-Henrik Fuxelius   
+ *          Date:     2023-05-08           
+ *
+ *  Flash and RAM share one address space on the host.
+ */
+
+#pragma once
+#include <stdint.h>
+
+#define PROGMEM
+#define PSTR(s)                   (s)
+#define pgm_read_byte(address)    (*(const uint8_t*)(address))
+#define pgm_read_word(address)    (*(const uint16_t*)(address))
@@ -0,0 +1,21 @@
+/*
+ *     host/avr/sleep.h
+ *
+ *          Project:  UART for ATmega4808
+ *          Author:   Hans-Henrik Fuxelius   
+ *          Date:     2023-05-08           
+ *
+ *  Sleeping lets simulated time run to the next event.
+ */
+
+#pragma once
+#include <avr/io.h>
+
+#define SLEEP_MODE_IDLE           0x00
+#define SLEEP_MODE_STANDBY        0x02
+#define SLEEP_MODE_PWR_DOWN       0x04
+
+#define set_sleep_mode(mode)      (SLPCTRL.CTRLA = (SLPCTRL.CTRLA & (uint8_t)~0x06) | (mode))
+#define sleep_enable()            (SLPCTRL.CTRLA |= 0x01)
+#define sleep_disable()           (SLPCTRL.CTRLA &= (uint8_t)~0x01)
+#define sleep_cpu()               sim_wait()
@@ -0,0 +1,659 @@
+/*
+ *     host/bench.c
+ *
+ *          Project:  UART for ATmega4808
+ *          Author:   Hans-Henrik Fuxelius
+ *          Date:     2023-05-08
+ *
+ *  Throughput, drop and latency benchmark of uart.c on simulated units; run
+ *  through `make bench`, which builds it once per ring size.
+ *
+ *  Traffic patterns, each at several baud rates:
+ *    tx-stream   try_write of one poll interval worth of line time every 5 ms
+ *    tx-bulk     one blocking usart_write of 4 KB
+ *    rx-stream   back-to-back receive for one second, polled every 5 ms
+ *    rx-burst    four 200 byte bursts at 20 % line load, polled every 20 ms
+ *    echo        back-to-back receive echoed with usart_write, polled every 1 ms
+ *    spsc        receive ISR and reader on two threads, checking the sequence
+ *    frame-byte  SLIP frames with CRC16, escaped byte by byte with a bitwise CRC
+ *    frame-slip  the same frames through uart_framing.c
+ *    fmt-printf  telemetry lines through fprintf on USART3_stream
+ *    fmt-direct  the same lines through uart_format.c
+ *
+ *  The first table holds the simulated patterns. Latency is from write call
+ *  to stop bit on the line for TX, from stop bit to read for RX and from stop
+ *  bit in to stop bit out for echo. ISRs take no simulated time, so these
+ *  numbers show buffering only. Received bytes carry a running counter; a
+ *  reader matches them to the line log by value, which holds as long as fewer
+ *  than 256 bytes are lost in a row.
+ *
+ *  With -w it prints the second table instead: spsc, frame and fmt, timed in
+ *  wall-clock ns per unit named in the last column. spsc gives the time per
+ *  byte sent. The frame patterns give the time per payload byte to encode and
+ *  to decode, rate% is payload over line bytes and drops counts frames not
+ *  decoded intact; each frame is sent and looped back on its own, so only
+ *  framing work is timed. The format patterns give the time per line, average
+ *  and maximum; the ring is drained between lines outside the timing, so with
+ *  lines longer than the ring the times include waiting for the line. Drops
+ *  count lines that differ from snprintf output.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdio.h>
+#include "uart.h"
+#include "uart_format.h"
+#include "uart_framing.h"
+#include "sim.h"
+
+#ifndef USART3_ENABLE
+#error "the benchmark runs on USART3; enable it in uart_settings.h"
+#endif
+
+#define BENCH_PORT   (&USART3_port)
+#define BENCH_UNIT   (&USART3)
+
+typedef struct {
+	const char*  pattern;
+	uint32_t     baud;
+	size_t       bytes;                     // Delivered
+	size_t       drops;                     // Offered or sent but not delivered
+	double       wire;                      // Share of the line rate used, percent
+	double       lat_avg;                   // Microseconds
+	double       lat_max;
+	uint32_t     isr_calls;
+	const char*  per;                       // Unit the wall-clock columns count in
+	double       ns_avg;                    // Wall-clock nanoseconds per unit, below 0 if unused
+	double       ns_max;
+	double       ns_encode;
+	double       ns_decode;
+} bench_result;
+
+typedef struct {
+	uint32_t        baud;
+	usart_config_t  config;
+} bench_rate;
+
+static int bench_errors;
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// HELPERS
+static void bench_start(usart_config_t config) {
+	sim_reset();
+	usart_set_rx_policy(BENCH_PORT, USART_RX_DROP_NEWEST);
+	usart_set_tx_hook(BENCH_PORT, 0, NULL);
+	usart_set_stream_mode(BENCH_PORT, USART_STREAM_BLOCKING);
+	usart_init(BENCH_PORT, config);
+	usart_reset_stats(BENCH_PORT);
+	sei();
+}
+
+static uint32_t bench_isr_calls(void) {
+	sim_counters_t c = sim_counters(BENCH_UNIT);
+	return c.rxc_calls + c.dre_calls + c.txc_calls;
+}
+
+static void bench_latency(bench_result* r, sim_time_t from, sim_time_t to) {
+	double us = (double)(to - from) / SIM_US;
+	r->lat_avg += us;
+	if (us > r->lat_max) {
+		r->lat_max = us;
+	}
+}
+
+// Sends seconds worth of back-to-back bytes carrying a running counter
+static size_t bench_rx_stream(sim_time_t duration) {
+	size_t n = duration / sim_char_time(BENCH_UNIT);
+	uint8_t* data = malloc(n);
+	for (size_t i = 0; i < n; i++) {
+		data[i] = (uint8_t)i;
+	}
+	sim_rx_send(BENCH_UNIT, data, n);
+	free(data);
+	return n;
+}
+
+// Reads everything available; matches each byte to its arrival in the line log
+static size_t bench_rx_drain(bench_result* r, size_t* pos, sim_time_t* arrivals) {
+	size_t count;
+	size_t n = 0;
+	const sim_byte_t* log = sim_rx_log(BENCH_UNIT, &count);
+	uint16_t c;
+
+	while (!((c = usart_read_char(BENCH_PORT)) & USART_NO_DATA)) {
+		while (*pos < count && log[*pos].data != (uint8_t)c) {
+			(*pos)++;
+		}
+		if (*pos == count) {
+			fprintf(stderr, "bench: byte 0x%02X not on the line\n", (uint8_t)c);
+			bench_errors++;
+			break;
+		}
+		bench_latency(r, log[*pos].time, sim_now());
+		if (arrivals) {
+			arrivals[r->bytes] = log[*pos].time;
+		}
+		(*pos)++;
+		r->bytes++;
+		n++;
+	}
+	return n;
+}
+
+static void bench_finish(bench_result* r) {
+	if (r->bytes) {
+		r->lat_avg /= r->bytes;
+	}
+	r->isr_calls = bench_isr_calls();
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// PATTERNS
+static bench_result bench_tx_stream(bench_rate rate) {
+	bench_result r = { .pattern = "tx-stream", .baud = rate.baud };
+	bench_start(rate.config);
+
+	const sim_time_t poll = 5 * SIM_MS;
+	const sim_time_t duration = SIM_S;
+	size_t chunk = poll / sim_char_time(BENCH_UNIT);
+	size_t offered = 0;
+	size_t accepted = 0;
+	sim_time_t* written = malloc((duration / poll + 1) * (chunk + 1) * sizeof(sim_time_t));
+	uint8_t* data = malloc(chunk + 1);
+
+	memset(data, 'x', chunk + 1);
+	for (sim_time_t t = 0; t < duration; t += poll) {
+		size_t n = usart_try_write(BENCH_PORT, data, chunk);
+		for (size_t i = 0; i < n; i++) {
+			written[accepted++] = sim_now();
+		}
+		offered += chunk;
+		sim_run(poll);
+	}
+	while (usart_tx_free(BENCH_PORT) < RBUFFER_SIZE || !(BENCH_UNIT->STATUS & USART_TXCIF_bm)) {
+		sim_wait();
+	}
+
+	size_t count;
+	const sim_byte_t* log = sim_tx_log(BENCH_UNIT, &count);
+	for (size_t i = 0; i < count; i++) {
+		bench_latency(&r, written[i], log[i].time);
+	}
+	r.bytes = count;
+	r.drops = offered - accepted;
+	r.wire = 100.0 * count * sim_char_time(BENCH_UNIT) / duration;
+	bench_finish(&r);
+	free(written);
+	free(data);
+	return r;
+}
+
+static bench_result bench_tx_bulk(bench_rate rate) {
+	bench_result r = { .pattern = "tx-bulk", .baud = rate.baud };
+	bench_start(rate.config);
+
+	static uint8_t data[4096];
+	memset(data, 'x', sizeof(data));
+	sim_time_t start = sim_now();
+	usart_write(BENCH_PORT, data, sizeof(data));
+	usart_close(BENCH_PORT);
+
+	size_t count;
+	const sim_byte_t* log = sim_tx_log(BENCH_UNIT, &count);
+	for (size_t i = 0; i < count; i++) {
+		bench_latency(&r, start, log[i].time);
+	}
+	r.bytes = count;
+	r.drops = sizeof(data) - count;
+	r.wire = 100.0 * count * sim_char_time(BENCH_UNIT) / (sim_now() - start);
+	bench_finish(&r);
+	return r;
+}
+
+// Receives a stream, or bursts of the given size that take 20 % of the line
+static bench_result bench_rx_poll(bench_rate rate, const char* pattern, size_t burst, sim_time_t poll) {
+	bench_result r = { .pattern = pattern, .baud = rate.baud };
+	bench_start(rate.config);
+
+	const sim_time_t period = 5 * burst * sim_char_time(BENCH_UNIT);
+	const sim_time_t duration = burst ? 4 * period : SIM_S;
+	sim_time_t next = 0;
+	size_t sent = 0;
+	size_t pos = 0;
+	uint8_t data[256];
+
+	if (!burst) {
+		sent = bench_rx_stream(duration);
+	}
+	for (sim_time_t t = 0; t < duration + poll; t += poll) {
+		if (burst && t >= next && t < duration) {
+			for (size_t i = 0; i < burst; i++) {
+				data[i] = (uint8_t)(sent + i);
+			}
+			sim_rx_send(BENCH_UNIT, data, burst);
+			sent += burst;
+			next += period;
+		}
+		sim_run(poll);
+		bench_rx_drain(&r, &pos, NULL);
+	}
+	sim_run(sim_rx_queued(BENCH_UNIT) * sim_char_time(BENCH_UNIT) + poll);
+	bench_rx_drain(&r, &pos, NULL);
+
+	r.drops = sent - r.bytes;
+	r.wire = 100.0 * r.bytes / sent;
+	bench_finish(&r);
+	return r;
+}
+
+static bench_result bench_echo(bench_rate rate) {
+	bench_result r = { .pattern = "echo", .baud = rate.baud };
+	bench_start(rate.config);
+
+	const sim_time_t poll = SIM_MS;
+	size_t sent = bench_rx_stream(SIM_S);
+	sim_time_t* arrivals = malloc(sent * sizeof(sim_time_t));
+	uint8_t* echo = malloc(sent);
+	size_t pos = 0;
+	bench_result rx = r;
+
+	memset(echo, 'e', sent);
+	do {
+		sim_run(poll);
+		usart_write(BENCH_PORT, echo, bench_rx_drain(&rx, &pos, arrivals));
+	} while (sim_rx_queued(BENCH_UNIT));
+	sim_run(poll);
+	usart_write(BENCH_PORT, echo, bench_rx_drain(&rx, &pos, arrivals));
+	usart_close(BENCH_PORT);
+
+	size_t count;
+	const sim_byte_t* log = sim_tx_log(BENCH_UNIT, &count);
+	for (size_t i = 0; i < count; i++) {
+		bench_latency(&r, arrivals[i], log[i].time);
+	}
+	r.bytes = count;
+	r.drops = sent - count;
+	r.wire = 100.0 * count / sent;
+	bench_finish(&r);
+	free(arrivals);
+	free(echo);
+	return r;
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// SPSC STRESS
+// The receive ISR runs on its own thread while the main thread reads. The ISR
+// side receives one byte at a time as long as the ring is not full, so both
+// sides keep meeting at the full and empty boundaries. Every byte must follow
+// the one before it unless the reader is told, through USART_BUFFER_OVERFLOW,
+// that data was lost in between.
+#define SPSC_BYTES  200000
+
+static volatile bool spsc_done;
+static volatile size_t spsc_read;
+
+static void* spsc_isr_thread(void* arg) {
+	usart_stats_t stats;
+	(void)arg;
+	sei();
+	while (sim_rx_queued(BENCH_UNIT)) {
+		usart_get_stats(BENCH_PORT, &stats);
+		if (stats.rx_bytes - spsc_read >= RBUFFER_SIZE) {
+			sched_yield();
+			continue;
+		}
+		sim_run(sim_char_time(BENCH_UNIT));
+	}
+	sim_run(2 * sim_char_time(BENCH_UNIT));
+	spsc_done = true;
+	return NULL;
+}
+
+static bench_result bench_spsc(bench_rate rate) {
+	bench_result r = { .pattern = "spsc", .baud = rate.baud,
+		.per = "byte", .ns_max = -1, .ns_encode = -1, .ns_decode = -1 };
+	bench_start(rate.config);
+	cli();													// Interrupts belong to the other thread
+
+	uint8_t* data = malloc(SPSC_BYTES);
+	for (size_t i = 0; i < SPSC_BYTES; i++) {
+		data[i] = (uint8_t)i;
+	}
+	sim_rx_send(BENCH_UNIT, data, SPSC_BYTES);
+	free(data);
+
+	struct timespec t0, t1;
+	pthread_t thread;
+	uint8_t expect = 0;
+	size_t errors = 0;
+
+	spsc_done = false;
+	spsc_read = 0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	pthread_create(&thread, NULL, spsc_isr_thread, NULL);
+	for (;;) {
+		bool done = spsc_done;
+		uint16_t c = usart_read_char(BENCH_PORT);
+		if (c & USART_NO_DATA) {
+			if (done) {
+				break;
+			}
+			sched_yield();
+			continue;
+		}
+		if ((uint8_t)c != expect && !(c & USART_BUFFER_OVERFLOW)) {
+			errors++;
+		}
+		expect = (uint8_t)c + 1;
+		spsc_read = ++r.bytes;
+	}
+	pthread_join(thread, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	double wall = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	if (errors) {
+		fprintf(stderr, "bench: spsc saw %zu bytes out of sequence\n", errors);
+		bench_errors++;
+	}
+	r.drops = SPSC_BYTES - r.bytes;
+	r.wire = 100.0 * r.bytes / SPSC_BYTES;
+	bench_finish(&r);
+	r.ns_avg = wall * 1e9 / SPSC_BYTES;
+	return r;
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// FRAMING
+// frame-byte is the framing layer the driver used to be wrapped in: every
+// byte goes through usart_send_char or usart_read_char and the CRC is shifted
+// out bit by bit. Both sides produce the same bytes on the line.
+#define FRAME_COUNT  2000
+
+static uint16_t frame_byte_crc(uint16_t crc, uint8_t c) {
+	crc ^= (uint16_t)c << 8;
+	for (uint8_t i = 0; i < 8; i++) {
+		crc = (crc & 0x8000) ? (uint16_t)(crc << 1) ^ 0x1021 : (uint16_t)(crc << 1);
+	}
+	return crc;
+}
+
+static void frame_byte_put(uint8_t c) {
+	if (c == USART_SLIP_END || c == USART_SLIP_ESC) {
+		usart_send_char(BENCH_PORT, USART_SLIP_ESC);
+		c = (c == USART_SLIP_END) ? USART_SLIP_ESC_END : USART_SLIP_ESC_ESC;
+	}
+	usart_send_char(BENCH_PORT, c);
+}
+
+static void frame_byte_send(const uint8_t* data, size_t len) {
+	uint16_t crc = USART_CRC16_INIT;
+	usart_send_char(BENCH_PORT, USART_SLIP_END);
+	for (size_t i = 0; i < len; i++) {
+		crc = frame_byte_crc(crc, data[i]);
+		frame_byte_put(data[i]);
+	}
+	frame_byte_put(crc >> 8);
+	frame_byte_put(crc & 0xFF);
+	usart_send_char(BENCH_PORT, USART_SLIP_END);
+}
+
+// Payload length of a good frame, 0 until one is complete
+static size_t frame_byte_receive(uint8_t* buf, size_t size) {
+	static size_t len;
+	static uint16_t crc = USART_CRC16_INIT;
+	static bool escape, bad;
+	uint16_t c;
+
+	while (!((c = usart_read_char(BENCH_PORT)) & USART_NO_DATA)) {
+		uint8_t b = (uint8_t)c;
+		if (c & 0xFF00) {
+			bad = true;
+		}
+		if (b == USART_SLIP_END) {
+			bool good = len > 2 && !bad && !escape && crc == 0;
+			size_t n = len;
+			len = 0;
+			crc = USART_CRC16_INIT;
+			escape = bad = false;
+			if (good) {
+				return n - 2;
+			}
+			continue;
+		}
+		if (b == USART_SLIP_ESC) {
+			escape = true;
+			continue;
+		}
+		if (escape) {
+			escape = false;
+			b = (b == USART_SLIP_ESC_END) ? USART_SLIP_END : (b == USART_SLIP_ESC_ESC) ? USART_SLIP_ESC : b;
+		}
+		if (len < size) {
+			buf[len++] = b;
+			crc = frame_byte_crc(crc, b);
+		}
+		else {
+			bad = true;
+		}
+	}
+	return 0;
+}
+
+static double bench_wall(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+// Sends FRAME_COUNT frames, each looped back into the receiver on its own.
+// Payloads are as long as the rings allow for a frame that is all escapes.
+static bench_result bench_frame(bench_rate rate, bool slip) {
+	bench_result r = { .pattern = slip ? "frame-slip" : "frame-byte", .baud = rate.baud,
+		.per = "byte", .ns_avg = -1, .ns_max = -1 };
+	bench_start(rate.config);
+
+	size_t payload = (RBUFFER_SIZE - 6) / 2;
+	uint8_t data[64];
+	uint8_t buf[64 + 2];
+	uint32_t seed = 1;
+	size_t line = 0;
+	size_t good = 0;
+	double encode = 0;
+	double decode = 0;
+	usart_slip_rx rx;
+
+	if (payload > sizeof(data)) {
+		payload = sizeof(data);
+	}
+	usart_slip_rx_init(&rx, buf, sizeof(buf));
+	for (int f = 0; f < FRAME_COUNT; f++) {
+		for (size_t i = 0; i < payload; i++) {
+			seed = seed * 1103515245 + 12345;
+			data[i] = (uint8_t)(seed >> 16);
+		}
+
+		size_t sent;
+		sim_tx_log(BENCH_UNIT, &sent);
+		double t0 = bench_wall();
+		if (slip) {
+			usart_slip_send(BENCH_PORT, data, payload);
+		}
+		else {
+			frame_byte_send(data, payload);
+		}
+		encode += bench_wall() - t0;
+		while (usart_tx_free(BENCH_PORT) < RBUFFER_SIZE || !(BENCH_UNIT->STATUS & USART_TXCIF_bm)) {
+			sim_wait();
+		}
+
+		size_t count;
+		const sim_byte_t* log = sim_tx_log(BENCH_UNIT, &count);
+		uint8_t frame[2 * 64 + 6];
+		for (size_t i = sent; i < count; i++) {
+			frame[i - sent] = log[i].data;
+		}
+		sim_rx_send(BENCH_UNIT, frame, count - sent);
+		sim_run((count - sent + 1) * sim_char_time(BENCH_UNIT));
+		line += count - sent;
+
+		t0 = bench_wall();
+		size_t len = slip ? usart_slip_receive(&rx, BENCH_PORT) : frame_byte_receive(buf, sizeof(buf));
+		decode += bench_wall() - t0;
+		if (len == payload && !memcmp(slip ? rx.buf : buf, data, payload)) {
+			good++;
+		}
+	}
+	r.bytes = good * payload;
+	r.drops = FRAME_COUNT - good;
+	r.wire = 100.0 * FRAME_COUNT * payload / line;
+	bench_finish(&r);
+	r.ns_encode = encode / (FRAME_COUNT * payload);
+	r.ns_decode = decode / (FRAME_COUNT * payload);
+	if (r.drops) {
+		fprintf(stderr, "bench: %s lost %zu frames\n", r.pattern, r.drops);
+		bench_errors++;
+	}
+	return r;
+}
+
+#define FORMAT_COUNT  2000
+
+// One telemetry line: a temperature in hundredths, an id and a counter
+static void format_line(bool direct, uint16_t temp, uint16_t id, uint32_t n) {
+	if (direct) {
+		usart_put_str(BENCH_PORT, "T=");
+		usart_put_fixed(BENCH_PORT, temp, 2);
+		usart_put_str(BENCH_PORT, " C id=0x");
+		usart_put_hex16(BENCH_PORT, id);
+		usart_put_str(BENCH_PORT, " n=");
+		usart_put_u32(BENCH_PORT, n);
+		usart_put_str(BENCH_PORT, "\r\n");
+	}
+	else {
+		fprintf(&USART3_stream, "T=%u.%02u C id=0x%04X n=%lu\r\n", temp / 100, temp % 100, id, (unsigned long)n);
+	}
+}
+
+static bench_result bench_format(bench_rate rate, bool direct) {
+	bench_result r = { .pattern = direct ? "fmt-direct" : "fmt-printf", .baud = rate.baud,
+		.per = "line", .ns_encode = -1, .ns_decode = -1 };
+	bench_start(rate.config);
+
+	uint32_t seed = 1;
+	uint32_t n = 99990;
+	sim_time_t start = sim_now();
+
+	for (int i = 0; i < FORMAT_COUNT; i++) {
+		seed = seed * 1103515245 + 12345;
+		uint16_t temp = (seed >> 8) % 10000;
+		uint16_t id = (uint16_t)(seed >> 16);
+		char expect[48];
+		int len = snprintf(expect, sizeof(expect), "T=%u.%02u C id=0x%04X n=%lu\r\n", temp / 100, temp % 100, id, (unsigned long)n);
+
+		size_t sent;
+		sim_tx_log(BENCH_UNIT, &sent);
+		double t0 = bench_wall();
+		format_line(direct, temp, id, n++);
+		double ns = bench_wall() - t0;
+		r.ns_avg += ns;
+		if (ns > r.ns_max) {
+			r.ns_max = ns;
+		}
+		while (usart_tx_free(BENCH_PORT) < RBUFFER_SIZE || !(BENCH_UNIT->STATUS & USART_TXCIF_bm)) {
+			sim_wait();
+		}
+
+		size_t count;
+		const sim_byte_t* log = sim_tx_log(BENCH_UNIT, &count);
+		bool same = count - sent == (size_t)len;
+		for (size_t j = sent; same && j < count; j++) {
+			same = log[j].data == (uint8_t)expect[j - sent];
+		}
+		if (same) {
+			r.bytes += len;
+		}
+		else {
+			r.drops++;
+		}
+	}
+	r.wire = 100.0 * r.bytes * sim_char_time(BENCH_UNIT) / (sim_now() - start);
+	r.isr_calls = bench_isr_calls();
+	r.ns_avg /= FORMAT_COUNT;
+	if (r.drops) {
+		fprintf(stderr, "bench: %s garbled %zu lines\n", r.pattern, r.drops);
+		bench_errors++;
+	}
+	return r;
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// MAIN
+static void bench_print(bench_result r) {
+	printf("%6d  %-10s %7lu %8zu %7zu %7.1f %10.1f %10.1f %9lu\n", RBUFFER_SIZE, r.pattern,
+		(unsigned long)r.baud, r.bytes, r.drops, r.wire, r.lat_avg, r.lat_max, (unsigned long)r.isr_calls);
+}
+
+static void bench_print_ns(double ns) {
+	if (ns < 0) {
+		printf(" %9s", "-");
+	}
+	else {
+		printf(" %9.1f", ns);
+	}
+}
+
+static void bench_print_wall(bench_result r) {
+	printf("%6d  %-10s %7lu %8zu %7zu %7.1f", RBUFFER_SIZE, r.pattern,
+		(unsigned long)r.baud, r.bytes, r.drops, r.wire);
+	bench_print_ns(r.ns_avg);
+	bench_print_ns(r.ns_max);
+	bench_print_ns(r.ns_encode);
+	bench_print_ns(r.ns_decode);
+	printf("  %s\n", r.per);
+}
+
+int main(int argc, char** argv) {
+	bench_rate rates[] = {
+		{ 9600,   USART_CONFIG(9600, USART_FORMAT_8N1) },
+		{ 115200, USART_CONFIG(115200, USART_FORMAT_8N1) },
+		{ 250000, USART_CONFIG(250000, USART_FORMAT_8N1) },
+	};
+
+	bool quiet = false;
+	bool wall = false;
+
+	for (int i = 1; i < argc; i++) {
+		quiet |= !strcmp(argv[i], "-q");
+		wall |= !strcmp(argv[i], "-w");
+	}
+	if (wall) {
+		if (!quiet) {
+			printf("%6s  %-10s %7s %8s %7s %7s %9s %9s %9s %9s  %s\n",
+				"ring", "pattern", "baud", "bytes", "drops", "rate%", "ns_avg", "ns_max", "ns_encode", "ns_decode", "per");
+		}
+		bench_print_wall(bench_spsc(rates[2]));
+		bench_print_wall(bench_frame(rates[1], false));
+		bench_print_wall(bench_frame(rates[1], true));
+		bench_print_wall(bench_format(rates[1], false));
+		bench_print_wall(bench_format(rates[1], true));
+		return bench_errors ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	if (!quiet) {
+		printf("%6s  %-10s %7s %8s %7s %7s %10s %10s %9s\n",
+			"ring", "pattern", "baud", "bytes", "drops", "rate%", "lat_avg_us", "lat_max_us", "isr_calls");
+	}
+	for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+		bench_print(bench_tx_stream(rates[i]));
+		bench_print(bench_tx_bulk(rates[i]));
+		bench_print(bench_rx_poll(rates[i], "rx-stream", 0, 5 * SIM_MS));
+		bench_print(bench_rx_poll(rates[i], "rx-burst", 200, 20 * SIM_MS));
+		bench_print(bench_echo(rates[i]));
+	}
+	return bench_errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
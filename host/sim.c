@@ -0,0 +1,637 @@
+/*
+ *     host/sim.c
+ *
+ *          Project:  UART for ATmega4808
+ *          Author:   Hans-Henrik Fuxelius
+ *          Date:     2023-05-08
+ */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+#include "sim.h"
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// REGISTERS
+USART_t   USART0, USART1, USART2, USART3, USART4, USART5;
+PORT_t    PORTA, PORTB, PORTC, PORTD, PORTE, PORTF, PORTG;
+TCB_t     TCB0, TCB1, TCB2, TCB3;
+RTC_t     RTC;
+SLPCTRL_t SLPCTRL;
+PORTMUX_t PORTMUX;
+__thread uint8_t SREG;
+
+// Vectors of the enabled ports are defined by uart.c; the others stay NULL
+#define SIM_VECTORS(n) \
+	void USART##n##_RXC_vect(void) __attribute__((weak)); \
+	void USART##n##_DRE_vect(void) __attribute__((weak)); \
+	void USART##n##_TXC_vect(void) __attribute__((weak))
+
+SIM_VECTORS(0);
+SIM_VECTORS(1);
+SIM_VECTORS(2);
+SIM_VECTORS(3);
+SIM_VECTORS(4);
+SIM_VECTORS(5);
+
+void TCB0_INT_vect(void) __attribute__((weak));
+void TCB1_INT_vect(void) __attribute__((weak));
+void TCB2_INT_vect(void) __attribute__((weak));
+void TCB3_INT_vect(void) __attribute__((weak));
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// UNITS
+typedef struct {
+	sim_byte_t*   data;
+	size_t        count;
+	size_t        size;
+} sim_log_t;
+
+typedef struct {
+	USART_t*      usart;
+	void        (*rxc)(void);
+	void        (*dre)(void);
+	void        (*txc)(void);
+
+	uint8_t       vector;                   // Number of the RXC vector; DRE and TXC follow
+	uint16_t*     line;                     // Characters sent to the unit, see sim_rx_send_words
+	size_t        line_len;
+	size_t        line_size;
+	size_t        line_pos;                 // Byte now on the line
+	uint32_t      line_baud;                // Rate of the characters sent; 0 follows the unit
+	PORT_t*       rx_port;                  // Pin that shows the line, see sim_rx_pin
+	uint8_t       rx_pin;
+	bool          rx_busy;
+	sim_time_t    rx_done;
+
+	uint8_t       fifo_data[2];             // Receive FIFO, oldest first
+	uint8_t       fifo_flags[2];            // RXDATAH error bits
+	uint8_t       fifo_count;
+
+	bool          tx_shifting;              // Transmit shift register
+	uint16_t      tx_shift;                 // Ninth bit in bit 8
+	sim_time_t    tx_done;
+	bool          tx_full;                  // Transmit data register
+	uint16_t      tx_data;
+	bool          txcif;
+
+	sim_log_t     rx_log;
+	sim_log_t     tx_log;
+	sim_counters_t counters;
+} sim_unit;
+
+// Vector numbers of the ATmega4809, which rank the interrupts; the lowest
+// pending one runs first. USART4 and USART5 are placed after the others.
+#define SIM_UNIT(n, v)  { .usart = &USART##n, .rxc = USART##n##_RXC_vect, .dre = USART##n##_DRE_vect, \
+	.txc = USART##n##_TXC_vect, .vector = v }
+
+static sim_unit sim_units[] = { SIM_UNIT(0, 17), SIM_UNIT(1, 26), SIM_UNIT(2, 31), SIM_UNIT(3, 37), SIM_UNIT(4, 40), SIM_UNIT(5, 43) };
+
+#define SIM_UNITS  (sizeof(sim_units) / sizeof(sim_units[0]))
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// TIMERS
+// TCBs in periodic interrupt mode: CNT counts CLK_PER, or CLK_PER / 2, up to
+// CCMP, then restarts from zero and sets CAPT. The registers hold the state;
+// the driver writes them directly, and time only moves in sim_advance, which
+// brings every running timer up to the new time first.
+typedef struct {
+	TCB_t*        tcb;
+	void        (*vect)(void);
+	uint8_t       vector;
+} sim_timer;
+
+static sim_timer sim_timers[] = {
+	{ &TCB0, TCB0_INT_vect, 12 }, { &TCB1, TCB1_INT_vect, 13 }, { &TCB2, TCB2_INT_vect, 25 }, { &TCB3, TCB3_INT_vect, 36 },
+};
+
+#define SIM_TIMERS  (sizeof(sim_timers) / sizeof(sim_timers[0]))
+
+static sim_time_t sim_time;
+static bool sim_in_isr;
+static pthread_mutex_t sim_lock;
+
+__attribute__((constructor)) static void sim_lock_init(void) {
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);   // ISRs nest ATOMIC_BLOCKs
+	pthread_mutex_init(&sim_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+void sim_cpu_lock(void) {
+	pthread_mutex_lock(&sim_lock);
+}
+
+void sim_cpu_unlock(void) {
+	pthread_mutex_unlock(&sim_lock);
+}
+
+static sim_unit* sim_unit_of(USART_t* usart) {
+	for (size_t i = 0; i < SIM_UNITS; i++) {
+		if (sim_units[i].usart == usart) {
+			return &sim_units[i];
+		}
+	}
+	fprintf(stderr, "sim: unknown USART\n");
+	abort();
+}
+
+// Logs the character in the low nine bits of word
+static void sim_log(sim_log_t* log, uint16_t word) {
+	if (log->count == log->size) {
+		log->size = log->size ? 2 * log->size : 1024;
+		log->data = realloc(log->data, log->size * sizeof(sim_byte_t));
+		if (!log->data) {
+			abort();
+		}
+	}
+	log->data[log->count++] = (sim_byte_t){ (uint8_t)word, (word >> 8) & 1, sim_time };
+}
+
+static uint8_t sim_data_bits(USART_t* usart) {
+	uint8_t chsize = usart->CTRLC & USART_CHSIZE_gm;
+	return (chsize >= USART_CHSIZE_9BITL_gc) ? 9 : 5 + chsize;
+}
+
+// Start, data, parity and stop bits
+static uint8_t sim_char_bits(USART_t* usart) {
+	uint8_t ctrlc = usart->CTRLC;
+	return 1 + sim_data_bits(usart) + ((ctrlc & USART_PMODE_gm) ? 1 : 0) + ((ctrlc & USART_SBMODE_bm) ? 2 : 1);
+}
+
+// One character at the rate set by BAUD and RXMODE
+sim_time_t sim_char_time(USART_t* usart) {
+	uint64_t s = ((usart->CTRLB & USART_RXMODE_gm) == USART_RXMODE_CLK2X_gc) ? 8 : 16;
+	uint64_t baud = usart->BAUD < 64 ? 64 : usart->BAUD;
+	return sim_char_bits(usart) * s * baud * SIM_S / (64ULL * F_CPU);
+}
+
+// One character on the receive line
+static sim_time_t sim_line_char_time(sim_unit* u) {
+	if (u->line_baud) {
+		return sim_char_bits(u->usart) * SIM_S / u->line_baud;
+	}
+	return sim_char_time(u->usart);
+}
+
+// Mirrors the unit state into the registers the driver reads directly
+static void sim_sync(sim_unit* u) {
+	USART_t* usart = u->usart;
+	uint8_t status = usart->STATUS & (uint8_t)~(USART_RXCIF_bm | USART_DREIF_bm | USART_TXCIF_bm);
+
+	if (u->fifo_count) {
+		status |= USART_RXCIF_bm;
+	}
+	if (!u->tx_full) {
+		status |= USART_DREIF_bm;
+	}
+	if (u->txcif) {
+		status |= USART_TXCIF_bm;
+	}
+	usart->STATUS = status;
+	usart->RXDATAL = u->fifo_data[0];
+	usart->RXDATAH = (u->fifo_count ? USART_RXCIF_bm : 0) | u->fifo_flags[0];
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// DRIVER HOOKS
+uint8_t sim_usart_read_rxdatal(USART_t* usart) {
+	sim_unit* u = sim_unit_of(usart);
+	if (!u->fifo_count) {
+		return usart->RXDATAL;
+	}
+	uint8_t data = u->fifo_data[0];
+	u->fifo_data[0] = u->fifo_data[1];
+	u->fifo_flags[0] = u->fifo_flags[1];
+	u->fifo_flags[1] = 0;
+	u->fifo_count--;
+	sim_sync(u);
+	return data;
+}
+
+// TXDATAH goes with each following TXDATAL write
+void sim_usart_write_txdatal(USART_t* usart, uint8_t data) {
+	sim_unit* u = sim_unit_of(usart);
+	uint16_t word = data | (uint16_t)((usart->TXDATAH & USART_DATA8_bm) << 8);
+	if (!(usart->CTRLB & USART_TXEN_bm)) {
+		return;
+	}
+	if (!u->tx_shifting) {
+		u->tx_shifting = true;
+		u->tx_shift = word;
+		u->tx_done = sim_time + sim_char_time(usart);
+	}
+	else if (!u->tx_full) {
+		u->tx_full = true;
+		u->tx_data = word;
+	}
+	sim_sync(u);										// Writes with DREIF clear are ignored
+}
+
+void sim_usart_write_txdatah(USART_t* usart, uint8_t data) {
+	sim_unit* u = sim_unit_of(usart);
+	if (!u->tx_full) {									// Ignored with DREIF clear
+		usart->TXDATAH = data;
+	}
+}
+
+void sim_usart_write_status(USART_t* usart, uint8_t bm) {
+	sim_unit* u = sim_unit_of(usart);
+	if (bm & USART_TXCIF_bm) {
+		u->txcif = false;
+	}
+	usart->STATUS &= (uint8_t)~(bm & (USART_RXSIF_bm | USART_ISFIF_bm | USART_BDF_bm));
+	usart->STATUS |= bm & USART_WFB_bm;
+	sim_sync(u);
+}
+
+void sim_tcb_write_intflags(TCB_t* tcb, uint8_t bm) {
+	tcb->INTFLAGS &= (uint8_t)~bm;
+}
+
+static uint8_t sim_timer_div(TCB_t* tcb) {
+	return (tcb->CTRLA & TCB_CLKSEL_gm) == TCB_CLKSEL_CLKDIV2_gc ? 2 : 1;
+}
+
+// Timer clock ticks from time zero to time
+static uint64_t sim_timer_ticks(TCB_t* tcb, sim_time_t time) {
+	return time * F_CPU / (SIM_S * sim_timer_div(tcb));
+}
+
+// Ticks from CNT to the next restart
+static uint32_t sim_timer_period_left(TCB_t* tcb) {
+	return (uint16_t)(tcb->CCMP - tcb->CNT) + 1;
+}
+
+static void sim_advance(sim_time_t time) {
+	for (size_t i = 0; i < SIM_TIMERS; i++) {
+		TCB_t* tcb = sim_timers[i].tcb;
+		if (!(tcb->CTRLA & TCB_ENABLE_bm)) {
+			continue;
+		}
+		uint64_t ticks = sim_timer_ticks(tcb, time) - sim_timer_ticks(tcb, sim_time);
+		uint32_t left = sim_timer_period_left(tcb);
+		if (ticks < left) {
+			tcb->CNT += (uint16_t)ticks;
+		}
+		else {
+			tcb->CNT = (uint16_t)((ticks - left) % ((uint32_t)tcb->CCMP + 1));
+			tcb->INTFLAGS |= TCB_CAPT_bm;
+		}
+	}
+	sim_time = time;
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// EVENTS & INTERRUPTS
+// Line events, and timer restarts that can raise an interrupt
+static bool sim_next_event(sim_time_t* time) {
+	bool found = false;
+	for (size_t i = 0; i < SIM_UNITS; i++) {
+		sim_unit* u = &sim_units[i];
+		if (u->rx_busy && (!found || u->rx_done < *time)) {
+			*time = u->rx_done;
+			found = true;
+		}
+		if (u->tx_shifting && (!found || u->tx_done < *time)) {
+			*time = u->tx_done;
+			found = true;
+		}
+	}
+	for (size_t i = 0; i < SIM_TIMERS; i++) {
+		TCB_t* tcb = sim_timers[i].tcb;
+		if ((tcb->CTRLA & TCB_ENABLE_bm) && (tcb->INTCTRL & TCB_CAPT_bm)) {
+			uint64_t div = sim_timer_div(tcb);
+			uint64_t tick = sim_timer_ticks(tcb, sim_time) + sim_timer_period_left(tcb);
+			sim_time_t at = (tick * SIM_S * div + F_CPU - 1) / F_CPU;	// First time at that tick
+			if (!found || at < *time) {
+				*time = at;
+				found = true;
+			}
+		}
+	}
+	return found;
+}
+
+static void sim_rx_complete(sim_unit* u) {
+	uint16_t word = u->line[u->line_pos++];
+	uint8_t data = (uint8_t)word;
+	sim_log(&u->rx_log, word & (SIM_RX_DATA8 | 0xFF));
+	uint8_t ctrlb = u->usart->CTRLB;
+	if ((ctrlb & USART_RXEN_bm) && !((ctrlb & USART_MPCM_bm) && !(word & SIM_RX_DATA8))) {
+		if (u->fifo_count < 2) {
+			u->fifo_data[u->fifo_count] = data;
+			u->fifo_flags[u->fifo_count] = (uint8_t)(word >> 8);
+			u->fifo_count++;
+		}
+		else {
+			u->fifo_flags[1] |= USART_BUFOVF_bm;		// The new byte is lost
+			u->counters.overruns++;
+		}
+	}
+	u->rx_busy = (u->line_pos < u->line_len);
+	if (u->rx_busy) {
+		u->rx_done = sim_time + sim_line_char_time(u);
+	}
+}
+
+static void sim_tx_complete(sim_unit* u) {
+	sim_log(&u->tx_log, u->tx_shift);
+	if (u->tx_full) {
+		u->tx_full = false;
+		u->tx_shift = u->tx_data;
+		u->tx_done = sim_time + sim_char_time(u->usart);
+	}
+	else {
+		u->tx_shifting = false;
+		u->txcif = true;
+	}
+}
+
+static void sim_process(void) {
+	for (size_t i = 0; i < SIM_UNITS; i++) {
+		sim_unit* u = &sim_units[i];
+		if (u->rx_busy && u->rx_done == sim_time) {
+			sim_rx_complete(u);
+		}
+		if (u->tx_shifting && u->tx_done == sim_time) {
+			sim_tx_complete(u);
+		}
+		sim_sync(u);
+	}
+}
+
+// Serves pending interrupts in vector order while the calling thread has them
+// enabled; returns whether any ran
+static bool sim_dispatch(void) {
+	uint32_t runs = 0;
+	while (!sim_in_isr && (SREG & CPU_I_bm)) {
+		void (*vector)(void) = NULL;
+		uint32_t* calls = NULL;
+		uint8_t number = 0xFF;
+		for (size_t i = 0; i < SIM_UNITS; i++) {
+			sim_unit* u = &sim_units[i];
+			uint8_t ctrla = u->usart->CTRLA;
+			uint8_t status = u->usart->STATUS;
+			if ((ctrla & USART_RXCIE_bm) && (status & USART_RXCIF_bm) && u->rxc) {
+				vector = u->rxc;
+				calls = &u->counters.rxc_calls;
+			}
+			else if ((ctrla & USART_DREIE_bm) && (status & USART_DREIF_bm) && u->dre) {
+				vector = u->dre;
+				calls = &u->counters.dre_calls;
+			}
+			else if ((ctrla & USART_TXCIE_bm) && (status & USART_TXCIF_bm) && u->txc) {
+				vector = u->txc;
+				calls = &u->counters.txc_calls;
+			}
+			if (vector) {
+				number = u->vector;
+				break;
+			}
+		}
+		for (size_t i = 0; i < SIM_TIMERS; i++) {
+			sim_timer* t = &sim_timers[i];
+			if (t->vector < number && (t->tcb->INTCTRL & t->tcb->INTFLAGS & TCB_CAPT_bm) && t->vect) {
+				vector = t->vect;
+				calls = NULL;
+				number = t->vector;
+			}
+		}
+		if (!vector) {
+			break;
+		}
+		if (calls) {
+			(*calls)++;
+		}
+		if (++runs > 1000000) {
+			fprintf(stderr, "sim: interrupt does not clear its flag\n");
+			abort();
+		}
+		sim_in_isr = true;
+		SREG &= (uint8_t)~CPU_I_bm;
+		vector();
+		SREG |= CPU_I_bm;
+		sim_in_isr = false;
+	}
+	return runs > 0;
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// SIMULATION
+void sim_reset(void) {
+	sim_cpu_lock();
+	for (size_t i = 0; i < SIM_UNITS; i++) {
+		sim_unit* u = &sim_units[i];
+		free(u->line);
+		free(u->rx_log.data);
+		free(u->tx_log.data);
+		memset((void*)u->usart, 0, sizeof(USART_t));
+		*u = (sim_unit){ .usart = u->usart, .rxc = u->rxc, .dre = u->dre, .txc = u->txc, .vector = u->vector };
+		sim_sync(u);
+	}
+	for (size_t i = 0; i < SIM_TIMERS; i++) {
+		memset((void*)sim_timers[i].tcb, 0, sizeof(TCB_t));
+	}
+	sim_time = 0;
+	sim_in_isr = false;
+	SREG = 0;
+	sim_cpu_unlock();
+}
+
+sim_time_t sim_now(void) {
+	return sim_time;
+}
+
+void sim_run(sim_time_t duration) {
+	sim_time_t end = sim_time + duration;
+	sim_time_t next;
+
+	sim_cpu_lock();
+	sim_dispatch();
+	sim_cpu_unlock();
+	for (;;) {
+		sim_cpu_lock();									// One event at a time, so a threaded
+		bool more = sim_next_event(&next) && next <= end;	// reader can get in between
+		if (more) {
+			sim_advance(next);
+			sim_process();
+			sim_dispatch();
+		}
+		sim_cpu_unlock();
+		if (!more) {
+			break;
+		}
+	}
+	sim_cpu_lock();
+	sim_advance(end);
+	sim_dispatch();
+	sim_cpu_unlock();
+}
+
+void sim_wait(void) {
+	sim_time_t next;
+
+	if (!(SREG & CPU_I_bm)) {
+		fprintf(stderr, "sim: waiting with interrupts disabled never ends\n");
+		abort();
+	}
+	sim_cpu_lock();
+	if (!sim_dispatch()) {								// Else the condition may hold already
+		if (!sim_next_event(&next)) {
+			fprintf(stderr, "sim: waiting with nothing left to happen\n");
+			abort();
+		}
+		sim_advance(next);
+		sim_process();
+		sim_dispatch();
+	}
+	sim_cpu_unlock();
+}
+
+// Advances to the next event without serving interrupts, for code that polls
+// flags with interrupts off
+void sim_poll(void) {
+	sim_time_t next;
+
+	sim_cpu_lock();
+	if (!sim_next_event(&next)) {
+		fprintf(stderr, "sim: polling with nothing left to happen\n");
+		abort();
+	}
+	sim_advance(next);
+	sim_process();
+	sim_cpu_unlock();
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// LINE SIDE
+// Appends len characters to the line; each takes the extra bits of its word
+static void sim_rx_append(USART_t* usart, const uint8_t* data, const uint16_t* words, size_t len) {
+	sim_cpu_lock();
+	sim_unit* u = sim_unit_of(usart);
+	if (u->line_len + len > u->line_size) {
+		u->line_size = 2 * (u->line_len + len);
+		u->line = realloc(u->line, u->line_size * sizeof(uint16_t));
+		if (!u->line) {
+			abort();
+		}
+	}
+	for (size_t i = 0; i < len; i++) {
+		u->line[u->line_len++] = data ? data[i] : words[i];
+	}
+	if (!u->rx_busy && u->line_pos < u->line_len) {
+		u->rx_busy = true;
+		u->rx_done = sim_time + sim_line_char_time(u);
+	}
+	sim_cpu_unlock();
+}
+
+void sim_rx_send(USART_t* usart, const uint8_t* data, size_t len) {
+	sim_rx_append(usart, data, NULL, len);
+}
+
+void sim_rx_send_words(USART_t* usart, const uint16_t* words, size_t len) {
+	sim_rx_append(usart, NULL, words, len);
+}
+
+void sim_line_baud(USART_t* usart, uint32_t baud) {
+	sim_unit_of(usart)->line_baud = baud;
+}
+
+void sim_rx_pin(USART_t* usart, PORT_t* port, uint8_t bm) {
+	sim_unit* u = sim_unit_of(usart);
+	u->rx_port = port;
+	u->rx_pin = bm;
+}
+
+// Receive line level now: idle high, then start, data LSB first, parity and
+// stop bits of the character on the line
+static bool sim_line_level(sim_unit* u) {
+	if (!u->rx_busy) {
+		return true;
+	}
+	USART_t* usart = u->usart;
+	sim_time_t length = sim_line_char_time(u);
+	uint8_t bits = sim_char_bits(usart);
+	uint8_t n = sim_data_bits(usart);
+	uint16_t word = u->line[u->line_pos];
+	uint8_t bit = (uint8_t)((sim_time - (u->rx_done - length)) * bits / length);
+	if (bit == 0) {
+		return false;
+	}
+	if (bit <= n) {
+		return (word >> (bit - 1)) & 1;
+	}
+	if (bit == n + 1 && (usart->CTRLC & USART_PMODE_gm)) {
+		bool odd = __builtin_parity(word & ((1 << n) - 1));
+		return ((usart->CTRLC & USART_PMODE_gm) == USART_PMODE_ODD_gc) ? !odd : odd;
+	}
+	return true;
+}
+
+// A polling loop reads the pin about every SIM_PIN_POLL CPU cycles; each read
+// moves time on by that much, serving interrupts if they are enabled
+#define SIM_PIN_POLL  4
+
+uint8_t sim_pin_read(PORT_t* port) {
+	sim_run(SIM_PIN_POLL * SIM_S / F_CPU);
+	sim_cpu_lock();
+	for (size_t i = 0; i < SIM_UNITS; i++) {
+		sim_unit* u = &sim_units[i];
+		if (u->rx_port == port) {
+			if (sim_line_level(u)) {
+				port->IN |= u->rx_pin;
+			}
+			else {
+				port->IN &= (uint8_t)~u->rx_pin;
+			}
+		}
+	}
+	sim_cpu_unlock();
+	return port->IN;
+}
+
+size_t sim_rx_queued(USART_t* usart) {
+	sim_unit* u = sim_unit_of(usart);
+	return u->line_len - u->line_pos;
+}
+
+const sim_byte_t* sim_rx_log(USART_t* usart, size_t* count) {
+	sim_unit* u = sim_unit_of(usart);
+	*count = u->rx_log.count;
+	return u->rx_log.data;
+}
+
+const sim_byte_t* sim_tx_log(USART_t* usart, size_t* count) {
+	sim_unit* u = sim_unit_of(usart);
+	*count = u->tx_log.count;
+	return u->tx_log.data;
+}
+
+sim_counters_t sim_counters(USART_t* usart) {
+	return sim_unit_of(usart)->counters;
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// STDIO
+// Formats with the host vsnprintf and puts each character through the stream
+// like the avr-libc vfprintf does
+int avr_fprintf(avr_file* stream, const char* fmt, ...) {
+	char buf[256];
+	va_list ap;
+
+	va_start(ap, fmt);
+	int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	for (int i = 0; i < n && i < (int)sizeof(buf) - 1; i++) {
+		if (stream->put(buf[i], stream)) {
+			return EOF;
+		}
+	}
+	return n;
+}
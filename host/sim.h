@@ -0,0 +1,76 @@
+/*
+ *     host/sim.h
+ *
+ *          Project:  UART for ATmega4808
+ *          Author:   Hans-Henrik Fuxelius
+ *          Date:     2023-05-08
+ *
+ *  Simulated USART units for running uart.c on the host.
+ *
+ *  Time is virtual and only moves inside sim_run and sim_wait; code between
+ *  those calls takes no time and interrupts are served there as well. Each
+ *  unit clocks bytes in and out at the rate set by its BAUD, CTRLB and CTRLC
+ *  registers, keeps the 2-level receive FIFO and the transmit data register of
+ *  the real unit and raises RXC, DRE and TXC as the hardware does. TCB0-3
+ *  count in periodic interrupt mode and raise CAPT; interrupts are served in
+ *  ATmega4809 vector order. ISR time is not modelled.
+ *
+ *  A threaded run calls sim_run from a second thread that plays the
+ *  interrupt side while the main thread uses the driver. ATOMIC_BLOCK takes
+ *  the CPU lock that thread holds while it runs, as cli holds off interrupts.
+ */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <avr/io.h>
+
+typedef uint64_t sim_time_t;                 // Nanoseconds
+
+#define SIM_US                   1000ULL
+#define SIM_MS                   1000000ULL
+#define SIM_S                    1000000000ULL
+
+typedef struct {
+    uint8_t     data;
+    bool        data8;                       // Ninth bit, in the 9-bit character sizes
+    sim_time_t  time;                        // Stop bit sampled
+} sim_byte_t;
+
+typedef struct {
+    uint32_t    rxc_calls;                   // Vector invocations
+    uint32_t    dre_calls;
+    uint32_t    txc_calls;
+    uint32_t    overruns;                    // Bytes lost to a full receive FIFO
+} sim_counters_t;
+
+void          sim_reset(void);
+sim_time_t    sim_now(void);
+void          sim_run(sim_time_t duration);  // Advances time and serves interrupts
+void          sim_wait(void);                // Advances to the next event
+void          sim_poll(void);                // The same without serving interrupts
+
+sim_time_t    sim_char_time(USART_t* usart); // One character on the line at the current settings
+
+// Ninth bit and receive errors of a character sent with sim_rx_send_words,
+// in the upper byte of its word at their RXDATAH positions. With MPCM set the
+// unit drops characters whose ninth bit is clear.
+#define SIM_RX_DATA8             (USART_DATA8_bm << 8)
+#define SIM_RX_PERR              (USART_PERR_bm << 8)
+#define SIM_RX_FERR              (USART_FERR_bm << 8)
+
+// Line side of a unit. Bytes sent to the unit follow each other without gaps.
+// Every byte that finished on the receive line is logged, including bytes the
+// FIFO had no room for, and every byte the unit sent is logged with its stop bit.
+void          sim_rx_send(USART_t* usart, const uint8_t* data, size_t len);
+void          sim_rx_send_words(USART_t* usart, const uint16_t* words, size_t len);
+// The line can run at its own rate, 0 following the unit, for auto-baud. The
+// receive line shows on the pin given to sim_rx_pin, read through the
+// driver's USART_PIN_READ, which moves time on by a few CPU cycles per read.
+void          sim_line_baud(USART_t* usart, uint32_t baud);
+void          sim_rx_pin(USART_t* usart, PORT_t* port, uint8_t bm);
+size_t        sim_rx_queued(USART_t* usart); // Not yet received
+const sim_byte_t* sim_rx_log(USART_t* usart, size_t* count);
+const sim_byte_t* sim_tx_log(USART_t* usart, size_t* count);
+sim_counters_t sim_counters(USART_t* usart);
@@ -0,0 +1,39 @@
+/*
+ *     host/stdio.h
+ *
+ *          Project:  UART for ATmega4808
+ *          Author:   Hans-Henrik Fuxelius   
+ *          Date:     2023-05-08           
+ *
+ *  The avr-libc stream setup used by uart.c on top of the host stdio. FILE
+ *  names the avr-libc style stream from here on; host streams such as stdout
+ *  keep working since they were declared above. fprintf picks avr_fprintf for
+ *  an avr_file and the host fprintf for anything else.
+ */
+
+#pragma once
+#include_next <stdio.h>
+#include <stdint.h>
+
+typedef struct avr_file {
+    int      (*put)(char, struct avr_file*);
+    int      (*get)(struct avr_file*);
+    uint8_t  flags;
+    void*    udata;
+} avr_file;
+
+#define FILE                         avr_file
+
+#define _FDEV_SETUP_READ             0x01
+#define _FDEV_SETUP_WRITE            0x02
+#define _FDEV_SETUP_RW               (_FDEV_SETUP_READ | _FDEV_SETUP_WRITE)
+#define _FDEV_ERR                    (-1)
+#define _FDEV_EOF                    (-2)
+
+#define FDEV_SETUP_STREAM(p, g, f)   { .put = (p), .get = (g), .flags = (f), .udata = NULL }
+#define fdev_set_udata(stream, u)    ((stream)->udata = (u))
+#define fdev_get_udata(stream)       ((stream)->udata)
+
+int avr_fprintf(avr_file* stream, const char* fmt, ...);
+
+#define fprintf(stream, ...)         _Generic((stream), avr_file*: avr_fprintf, default: fprintf)(stream, __VA_ARGS__)
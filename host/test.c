@@ -0,0 +1,737 @@
+/*
+ *     host/test.c
+ *
+ *          Project:  UART for ATmega4808
+ *          Author:   Hans-Henrik Fuxelius
+ *          Date:     2023-05-08
+ *
+ *  Regression tests of uart.c on simulated units; run through `make test`,
+ *  which builds it once per ring size in TEST_SIZES. Every test starts from
+ *  sim_reset and a freshly initialised USART3 and reports each failed check
+ *  with its line; the exit status tells whether any failed.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdio.h>
+#include "uart.h"
+#include "uart_log.h"
+#include "sim.h"
+
+#ifndef USART3_ENABLE
+#error "the tests run on USART3; enable it in uart_settings.h"
+#endif
+
+#define TEST_PORT    (&USART3_port)
+#define TEST_UNIT    (&USART3)
+#define TEST_CONFIG  USART_CONFIG(115200, USART_FORMAT_8N1)
+
+static int test_failures;
+
+#define CHECK(cond) \
+	do { if (!(cond)) { fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+		test_failures++; } } while (0)
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// HELPERS
+static void test_start(usart_config_t config, uint8_t policy) {
+	sim_reset();
+	usart_set_rx_policy(TEST_PORT, policy);
+	usart_set_tx_hook(TEST_PORT, 0, NULL);
+	usart_set_stream_mode(TEST_PORT, USART_STREAM_BLOCKING);
+	usart_init(TEST_PORT, config);
+	usart_reset_stats(TEST_PORT);
+	sei();
+}
+
+static void test_sleep_us(long us) {
+	struct timespec t = { 0, us * 1000 };
+	nanosleep(&t, NULL);
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// SPSC RING
+// The receive ISR runs on a second thread without waiting for the reader,
+// which pauses every 64 bytes, so the ring overruns over and over while both
+// sides move their indices around the wrap. Bytes carry a running counter:
+// each byte read must follow the previous one unless the driver reported a
+// loss in between, and every byte sent must be read or counted as dropped.
+#define SPSC_BYTES  20000
+
+static volatile bool spsc_done;
+
+static void* spsc_isr_thread(void* arg) {
+	(void)arg;
+	sei();
+	while (sim_rx_queued(TEST_UNIT)) {
+		sim_run(sim_char_time(TEST_UNIT));
+		sched_yield();								// Let the reader interleave
+	}
+	sim_run(2 * sim_char_time(TEST_UNIT));
+	spsc_done = true;
+	return NULL;
+}
+
+static void test_spsc_overrun(uint8_t policy) {
+	test_start(TEST_CONFIG, policy);
+	cli();											// Interrupts belong to the other thread
+
+	uint8_t* data = malloc(SPSC_BYTES);
+	for (size_t i = 0; i < SPSC_BYTES; i++) {
+		data[i] = (uint8_t)i;
+	}
+	sim_rx_send(TEST_UNIT, data, SPSC_BYTES);
+	free(data);
+
+	pthread_t thread;
+	uint8_t expect = 0;
+	bool lost = false;
+	size_t read = 0;
+	size_t flagged = 0;
+	size_t out_of_sequence = 0;
+
+	spsc_done = false;
+	pthread_create(&thread, NULL, spsc_isr_thread, NULL);
+	for (;;) {
+		bool done = spsc_done;
+		uint16_t c = usart_read_char(TEST_PORT);
+		if (c & USART_NO_DATA) {
+			if (c & USART_BUFFER_OVERFLOW) {
+				lost = true;						// Reported with the ring empty
+				flagged++;
+			}
+			if (done) {
+				break;
+			}
+			sched_yield();
+			continue;
+		}
+		if (c & USART_BUFFER_OVERFLOW) {
+			flagged++;
+		}
+		else if (!lost && (uint8_t)c != expect) {
+			out_of_sequence++;
+		}
+		lost = false;
+		expect = (uint8_t)c + 1;
+		if (++read % 64 == 0) {
+			test_sleep_us(200);
+		}
+	}
+	pthread_join(thread, NULL);
+
+	usart_stats_t stats;
+	usart_get_stats(TEST_PORT, &stats);
+	CHECK(out_of_sequence == 0);
+	CHECK(stats.rx_dropped > 0);					// The ring did overrun
+	CHECK(flagged > 0);
+	CHECK(flagged <= stats.rx_dropped);
+	CHECK(read + stats.rx_dropped + sim_counters(TEST_UNIT).overruns == SPSC_BYTES);
+	sei();
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// RX OVERFLOW REPORTING
+static void test_send(const uint8_t* data, size_t len) {
+	sim_rx_send(TEST_UNIT, data, len);
+	sim_run((len + 1) * sim_char_time(TEST_UNIT));
+}
+
+// A burst whose tail is dropped with nothing after it reports the loss on the
+// first read that finds the ring empty, once
+static void test_overflow_at_end(void) {
+	uint8_t data[RBUFFER_SIZE + 8];
+	test_start(TEST_CONFIG, USART_RX_DROP_NEWEST);
+	for (size_t i = 0; i < sizeof(data); i++) {
+		data[i] = (uint8_t)i;
+	}
+	test_send(data, sizeof(data));
+
+	for (size_t i = 0; i < RBUFFER_SIZE; i++) {
+		CHECK(usart_read_char(TEST_PORT) == (uint8_t)i);
+	}
+	CHECK(usart_read_char(TEST_PORT) == (USART_BUFFER_OVERFLOW | USART_NO_DATA));
+	CHECK(usart_read_char(TEST_PORT) == USART_NO_DATA);
+	test_send((const uint8_t*)"z", 1);
+	CHECK(usart_read_char(TEST_PORT) == 'z');			// Loss not reported twice
+}
+
+// The byte stored after a loss keeps its own receive errors
+static void test_overflow_keeps_errors(void) {
+	uint16_t words[RBUFFER_SIZE + 2];
+	test_start(TEST_CONFIG, USART_RX_DROP_NEWEST);
+	for (size_t i = 0; i < RBUFFER_SIZE + 1; i++) {
+		words[i] = 'a';
+	}
+	words[RBUFFER_SIZE + 1] = 'p' | SIM_RX_PERR;
+	sim_rx_send_words(TEST_UNIT, words, RBUFFER_SIZE + 1);
+	sim_run((RBUFFER_SIZE + 2) * sim_char_time(TEST_UNIT));
+	for (size_t i = 0; i < RBUFFER_SIZE; i++) {
+		CHECK(usart_read_char(TEST_PORT) == 'a');
+	}
+	sim_rx_send_words(TEST_UNIT, &words[RBUFFER_SIZE + 1], 1);
+	sim_run(2 * sim_char_time(TEST_UNIT));
+	CHECK(usart_read_char(TEST_PORT) == (USART_BUFFER_OVERFLOW | USART_PARITY_ERROR | 'p'));
+	CHECK(usart_read_char(TEST_PORT) == USART_NO_DATA);
+}
+
+// A damaged byte that finds every mark in use is dropped, and the next byte
+// stored reports the loss; clean bytes before them still read as a span
+static void test_flag_marks_full(void) {
+	uint16_t words[USART_RX_MARKS + 2];
+	const char* data;
+	usart_stats_t stats;
+	test_start(TEST_CONFIG, USART_RX_DROP_NEWEST);
+	words[0] = 'a';
+	for (size_t i = 1; i <= USART_RX_MARKS + 1; i++) {
+		words[i] = ('0' + i) | SIM_RX_FERR;
+	}
+	sim_rx_send_words(TEST_UNIT, words, USART_RX_MARKS + 2);
+	sim_run((USART_RX_MARKS + 3) * sim_char_time(TEST_UNIT));
+
+	CHECK(usart_rx_peek(TEST_PORT, &data) == 1 && data[0] == 'a');
+	usart_rx_commit(TEST_PORT, 1);
+	CHECK(usart_rx_peek(TEST_PORT, &data) == 0);
+	for (size_t i = 1; i <= USART_RX_MARKS; i++) {
+		CHECK(usart_read_char(TEST_PORT) == (USART_FRAME_ERROR | ('0' + i)));
+	}
+	test_send((const uint8_t*)"z", 1);
+	CHECK(usart_read_char(TEST_PORT) == (USART_BUFFER_OVERFLOW | 'z'));
+	CHECK(usart_read_char(TEST_PORT) == USART_NO_DATA);
+	usart_get_stats(TEST_PORT, &stats);
+	CHECK(stats.rx_dropped == 1);
+}
+
+// Dropping the oldest byte drops its flag, and the new oldest byte reports
+// the loss along with its own flag
+static void test_drop_oldest_flags(void) {
+	uint16_t words[RBUFFER_SIZE + 1];
+	test_start(TEST_CONFIG, USART_RX_DROP_OLDEST);
+	words[0] = 'p' | SIM_RX_PERR;
+	words[1] = 'f' | SIM_RX_FERR;
+	for (size_t i = 2; i < RBUFFER_SIZE + 1; i++) {
+		words[i] = 'a';
+	}
+	sim_rx_send_words(TEST_UNIT, words, RBUFFER_SIZE + 1);
+	sim_run((RBUFFER_SIZE + 2) * sim_char_time(TEST_UNIT));
+	CHECK(usart_read_char(TEST_PORT) == (USART_BUFFER_OVERFLOW | USART_FRAME_ERROR | 'f'));
+	for (size_t i = 2; i < RBUFFER_SIZE + 1; i++) {
+		CHECK(usart_read_char(TEST_PORT) == 'a');
+	}
+	CHECK(usart_read_char(TEST_PORT) == USART_NO_DATA);
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// FRAME ASSEMBLER
+// A delimited line longer than the ring is closed as truncated when its first
+// byte is dropped, instead of filling the ring with a frame that never ends
+static void test_frame_longer_than_ring(void) {
+	uint8_t line[RBUFFER_SIZE + 9];
+	uint8_t buf[sizeof(line)];
+	uint16_t errors;
+	test_start(TEST_CONFIG, USART_RX_DROP_NEWEST);
+	usart_set_frame(TEST_PORT, USART_FRAME_DELIMITER, '\r', NULL);
+	for (size_t i = 0; i < sizeof(line) - 1; i++) {
+		line[i] = 'a' + i % 26;
+	}
+	line[sizeof(line) - 1] = '\r';
+	test_send(line, sizeof(line));
+
+	CHECK(usart_frames(TEST_PORT) == 1);
+	CHECK(usart_read_frame(TEST_PORT, buf, sizeof(buf), &errors) == RBUFFER_SIZE);
+	CHECK(errors == USART_BUFFER_OVERFLOW);
+	CHECK(!memcmp(buf, line, RBUFFER_SIZE));
+	CHECK(usart_frames(TEST_PORT) == 0);
+
+	test_send((const uint8_t*)"ok\r", 3);
+	CHECK(usart_frames(TEST_PORT) == 1);
+	CHECK(usart_read_frame(TEST_PORT, buf, sizeof(buf), &errors) == 3);
+	CHECK(!memcmp(buf, "ok\r", 3));
+	CHECK(errors == USART_BUFFER_OVERFLOW);			// Its first byte follows the lost tail
+	usart_set_frame(TEST_PORT, USART_FRAME_OFF, 0, NULL);
+}
+
+// Gap frames run on USART0 timed by TCB2, whose vector ranks below USART0
+// RXC, so a byte and an expired gap pending together reach RXC first; the
+// Makefile enables both for the tests.
+#define GAP_PORT  (&USART0_port)
+#define GAP_UNIT  (&USART0)
+#define GAP_BITS  20
+
+static void test_gap_start(void) {
+	sim_reset();
+	usart_init(GAP_PORT, TEST_CONFIG);
+	usart_set_frame(GAP_PORT, USART_FRAME_GAP, GAP_BITS, NULL);
+	sei();
+}
+
+// Sends text, then keeps the line silent for `idle` character times
+static void test_gap_send(const char* text, uint8_t idle) {
+	size_t len = strlen(text);
+	sim_rx_send(GAP_UNIT, (const uint8_t*)text, len);
+	sim_run((len + idle) * sim_char_time(GAP_UNIT));
+}
+
+static bool test_gap_frame_is(const char* text) {
+	uint8_t buf[16];
+	uint16_t errors;
+	size_t len = usart_read_frame(GAP_PORT, buf, sizeof(buf), &errors);
+	return len == strlen(text) && !memcmp(buf, text, len) && !errors;
+}
+
+// A pause shorter than the gap keeps the frame open; longer ones close it,
+// also with frames queued back to back
+static void test_gap_frames(void) {
+	test_gap_start();
+	test_gap_send("ab", 1);
+	test_gap_send("cd", 4);
+	CHECK(usart_frames(GAP_PORT) == 1);
+	CHECK(test_gap_frame_is("abcd"));
+
+	test_gap_send("ef", 4);
+	test_gap_send("gh", 4);
+	test_gap_send("i", 4);
+	CHECK(usart_frames(GAP_PORT) == 3);
+	CHECK(test_gap_frame_is("ef"));
+	CHECK(test_gap_frame_is("gh"));
+	CHECK(test_gap_frame_is("i"));
+	CHECK(usart_frames(GAP_PORT) == 0);
+	usart_set_frame(GAP_PORT, USART_FRAME_OFF, 0, NULL);
+}
+
+// With interrupts held off past the gap and into the next byte, RXC runs
+// before the gap interrupt and must close the frame before counting the byte
+static void test_gap_expired_before_byte(void) {
+	test_gap_start();
+	test_gap_send("ab", 0);
+	cli();
+	test_gap_send("c", 4);
+	sei();
+	sim_run(4 * sim_char_time(GAP_UNIT));
+	CHECK(usart_frames(GAP_PORT) == 2);
+	CHECK(test_gap_frame_is("ab"));
+	CHECK(test_gap_frame_is("c"));
+	usart_set_frame(GAP_PORT, USART_FRAME_OFF, 0, NULL);
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// STREAM INPUT
+// Reads go through the stream's get function, as getc does on the MCU
+#define TEST_STREAM  (&USART3_stream)
+
+static int test_getc(void) {
+	return TEST_STREAM->get(TEST_STREAM);
+}
+
+// Reads up to len characters until the stream reports anything but a byte
+static size_t test_gets(char* buf, size_t len) {
+	size_t n = 0;
+	int c;
+	while (n < len && (c = test_getc()) >= 0) {
+		buf[n++] = (char)c;
+	}
+	return n;
+}
+
+// Non-blocking: an empty ring reads _FDEV_EOF, any byte is ready at once
+static void test_stream_nonblock(void) {
+	test_start(TEST_CONFIG, USART_RX_DROP_NEWEST);
+	usart_set_stream_mode(TEST_PORT, USART_STREAM_NONBLOCK);
+	CHECK(test_getc() == _FDEV_EOF);
+	test_send((const uint8_t*)"a", 1);
+	CHECK(test_getc() == 'a');
+	CHECK(test_getc() == _FDEV_EOF);
+}
+
+// Line mode holds a partial line back until its '\n' is in, then gives
+// the whole line and nothing of the next one
+static void test_stream_line(void) {
+	char buf[8];
+	test_start(TEST_CONFIG, USART_RX_DROP_NEWEST);
+	usart_set_stream_mode(TEST_PORT, USART_STREAM_LINE | USART_STREAM_NONBLOCK);
+	test_send((const uint8_t*)"ab", 2);
+	CHECK(test_getc() == _FDEV_EOF);
+	test_send((const uint8_t*)"c\nde", 4);
+	CHECK(test_gets(buf, sizeof(buf)) == 4 && !memcmp(buf, "abc\n", 4));
+	CHECK(test_getc() == _FDEV_EOF);
+	test_send((const uint8_t*)"\n", 1);
+	CHECK(test_gets(buf, sizeof(buf)) == 3 && !memcmp(buf, "de\n", 3));
+}
+
+// A full ring without a '\n' is released, since no '\n' could get in
+static void test_stream_line_full(void) {
+	uint8_t line[RBUFFER_SIZE];
+	char buf[RBUFFER_SIZE + 1];
+	test_start(TEST_CONFIG, USART_RX_DROP_NEWEST);
+	usart_set_stream_mode(TEST_PORT, USART_STREAM_LINE | USART_STREAM_NONBLOCK);
+	memset(line, 'x', sizeof(line));
+	test_send(line, sizeof(line) - 1);
+	CHECK(test_getc() == _FDEV_EOF);
+	test_send(line, 1);
+	CHECK(test_gets(buf, sizeof(buf)) == RBUFFER_SIZE);
+}
+
+// A blocking line read sleeps until the whole line has arrived
+static void test_stream_line_blocking(void) {
+	test_start(TEST_CONFIG, USART_RX_DROP_NEWEST);
+	usart_set_stream_mode(TEST_PORT, USART_STREAM_LINE);
+	sim_rx_send(TEST_UNIT, (const uint8_t*)"hi\n", 3);
+	CHECK(test_getc() == 'h');
+	CHECK(sim_now() >= 3 * sim_char_time(TEST_UNIT));
+	CHECK(test_getc() == 'i');
+	CHECK(test_getc() == '\n');
+}
+
+// A receiver stopped by USART_RX_STOP releases the partial line, also once
+// bytes were read around the stream, and reads _FDEV_ERR when drained
+static void test_stream_rx_stop(void) {
+	uint8_t line[RBUFFER_SIZE + 1];
+	char buf[RBUFFER_SIZE];
+	test_start(TEST_CONFIG, USART_RX_STOP);
+	usart_set_stream_mode(TEST_PORT, USART_STREAM_LINE | USART_STREAM_NONBLOCK);
+	memset(line, 'x', sizeof(line));
+	test_send(line, sizeof(line));
+	CHECK(usart_read_char(TEST_PORT) == 'x');
+	CHECK(test_gets(buf, sizeof(buf)) == RBUFFER_SIZE - 1);
+	CHECK(test_getc() == _FDEV_ERR);
+	usart_rx_resume(TEST_PORT);
+	CHECK(test_getc() == _FDEV_EOF);
+}
+
+// A damaged byte reads as _FDEV_ERR and the bytes after it as usual
+static void test_stream_flagged(void) {
+	static const uint16_t words[] = { 'a', 'p' | SIM_RX_PERR, 'f' | SIM_RX_FERR, 'b' };
+	test_start(TEST_CONFIG, USART_RX_DROP_NEWEST);
+	usart_set_stream_mode(TEST_PORT, USART_STREAM_NONBLOCK);
+	sim_rx_send_words(TEST_UNIT, words, 4);
+	sim_run(5 * sim_char_time(TEST_UNIT));
+	CHECK(test_getc() == 'a');
+	CHECK(test_getc() == _FDEV_ERR);
+	CHECK(test_getc() == _FDEV_ERR);
+	CHECK(test_getc() == 'b');
+	CHECK(test_getc() == _FDEV_EOF);
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// MULTIDROP
+#define TEST_CONFIG_9BIT  USART_CONFIG(115200, USART_FORMAT_9N1)
+
+// Expects the unit to have sent these characters, ninth bit in bit 8
+static bool test_tx_words_are(const uint16_t* words, size_t len) {
+	size_t count;
+	const sim_byte_t* log = sim_tx_log(TEST_UNIT, &count);
+	if (count != len) {
+		return false;
+	}
+	for (size_t i = 0; i < count; i++) {
+		if ((log[i].data | log[i].data8 << 8) != words[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Data after an address goes out with the ninth bit clear, also when the
+// address was written with a byte still shifting out, so DREIF was clear
+// right after it, and when one address follows another
+static void test_address_ninth_bit(void) {
+	static const uint16_t sent[] = { 'x', 'y', 0x142, 'a', 'b', 0x101, 0x102, 'z' };
+	test_start(TEST_CONFIG_9BIT, USART_RX_DROP_NEWEST);
+	usart_write(TEST_PORT, "xy", 2);
+	usart_send_address(TEST_PORT, 0x42);
+	usart_write(TEST_PORT, "ab", 2);
+	usart_send_address(TEST_PORT, 0x01);
+	usart_send_address(TEST_PORT, 0x02);
+	usart_write(TEST_PORT, "z", 1);
+	while (usart_tx_free(TEST_PORT) < RBUFFER_SIZE || !(TEST_UNIT->STATUS & USART_TXCIF_bm)) {
+		sim_wait();
+	}
+	CHECK(test_tx_words_are(sent, sizeof(sent) / sizeof(sent[0])));
+}
+
+// The receiver takes data frames after its own or the broadcast address only
+static void test_address_filter(void) {
+	static const uint16_t words[] = {
+		0x41 | SIM_RX_DATA8, 'n', 'o',
+		0x42 | SIM_RX_DATA8, 'y', 'e', 's',
+		0x43 | SIM_RX_DATA8, 'n',
+		0xFF | SIM_RX_DATA8, '!',
+	};
+	char got[8];
+	size_t n = 0;
+	uint16_t c;
+	test_start(TEST_CONFIG_9BIT, USART_RX_DROP_NEWEST);
+	usart_set_address(TEST_PORT, 0x42, 0xFF);
+	sim_rx_send_words(TEST_UNIT, words, sizeof(words) / sizeof(words[0]));
+	sim_run((sizeof(words) / sizeof(words[0]) + 1) * sim_char_time(TEST_UNIT));
+	while (n < sizeof(got) && !((c = usart_read_char(TEST_PORT)) & USART_NO_DATA)) {
+		got[n++] = (char)c;
+	}
+	CHECK(n == 4 && !memcmp(got, "yes!", 4));
+	usart_clear_address(TEST_PORT);
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// AUTO-BAUD
+// The sync character comes at 9600 baud to a port set to 115200, after 0xFF
+// characters whose lone start bits must not be taken for it. The port keeps
+// sending meanwhile, which needs its DRE interrupt while auto-baud waits.
+static void test_autobaud_soft(uint16_t timeout_ms) {
+	static const uint8_t line[] = { 0xFF, 0xFF, 0x55 };
+	char text[30];
+	size_t sent;
+	test_start(TEST_CONFIG, USART_RX_DROP_NEWEST);
+	sim_rx_pin(TEST_UNIT, &USART3_RX_PORT, USART3_RX_PIN_bm);
+	sim_line_baud(TEST_UNIT, 9600);
+	memset(text, '.', sizeof(text));
+	usart_write(TEST_PORT, text, sizeof(text));
+	sim_rx_send(TEST_UNIT, line, sizeof(line));
+
+	uint32_t baud = usart_autobaud(TEST_PORT, USART_AUTOBAUD_SOFT, timeout_ms);
+	CHECK(baud >= 9600 - 96 && baud <= 9600 + 96);
+	sim_tx_log(TEST_UNIT, &sent);
+	CHECK(sent >= sizeof(text) / 3);				// Only the characters on the line stop it
+
+	test_send((const uint8_t*)"ok", 2);
+	uint16_t c;
+	uint16_t prev = 0;
+	while (!((c = usart_read_char(TEST_PORT)) & USART_NO_DATA)) {
+		prev = (prev << 8) | (uint8_t)c;
+	}
+	CHECK(prev == ('o' << 8 | 'k'));				// Received at the new rate
+}
+
+// Without a sync character it gives up after the timeout, sending all along
+static void test_autobaud_timeout(void) {
+	char text[30];
+	size_t sent;
+	test_start(TEST_CONFIG, USART_RX_DROP_NEWEST);
+	sim_rx_pin(TEST_UNIT, &USART3_RX_PORT, USART3_RX_PIN_bm);
+	memset(text, '.', sizeof(text));
+	usart_write(TEST_PORT, text, sizeof(text));
+
+	uint16_t baud = TEST_UNIT->BAUD;
+	CHECK(usart_autobaud(TEST_PORT, USART_AUTOBAUD_SOFT, 5) == 0);
+	CHECK(sim_now() >= 5 * SIM_MS * 99 / 100 && sim_now() < 8 * SIM_MS);	// F_CPU / 1000 rounds down
+	CHECK(TEST_UNIT->BAUD == baud);
+	sim_tx_log(TEST_UNIT, &sent);
+	CHECK(sent == sizeof(text));
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// RAW CONFIG
+// A BAUD value from BAUD_RATE runs the port in normal mode at that rate
+static void test_config_raw(void) {
+	test_start(USART_CONFIG_RAW(BAUD_RATE(9600), USART_FORMAT_8N1), USART_RX_DROP_NEWEST);
+	CHECK(TEST_UNIT->BAUD == BAUD_RATE(9600));
+	CHECK((TEST_UNIT->CTRLB & USART_RXMODE_gm) == USART_RXMODE_NORMAL_gc);
+	CHECK(TEST_UNIT->CTRLC == USART_FORMAT_8N1);
+	test_send((const uint8_t*)"k", 1);
+	CHECK(usart_read_char(TEST_PORT) == 'k');
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// CLOSE
+static bool test_tx_log_is(const char* text) {
+	size_t count;
+	const sim_byte_t* log = sim_tx_log(TEST_UNIT, &count);
+	if (count != strlen(text)) {
+		return false;
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (log[i].data != (uint8_t)text[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Closing with interrupts off sends what is queued by polling and returns
+static void test_close_interrupts_off(void) {
+	test_start(TEST_CONFIG, USART_RX_DROP_NEWEST);
+	usart_write(TEST_PORT, "hello", 5);
+	cli();
+	usart_close(TEST_PORT);
+	CHECK(!usart_closing(TEST_PORT));
+	CHECK(!(TEST_UNIT->CTRLB & USART_TXEN_bm));
+	CHECK(test_tx_log_is("hello"));
+
+	// Everything already out: shut down at once, interrupts on or off
+	test_start(TEST_CONFIG, USART_RX_DROP_NEWEST);
+	usart_write(TEST_PORT, "x", 1);
+	sim_run(3 * sim_char_time(TEST_UNIT));
+	cli();
+	usart_close_async(TEST_PORT, NULL);
+	CHECK(!usart_closing(TEST_PORT));
+	sei();
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// TX BACKPRESSURE
+// The rings are filled with interrupts off, so nothing drains meanwhile
+#define TEST_WATERMARK  (RBUFFER_SIZE / 2)
+
+static int test_hook_calls;
+static size_t test_hook_free;
+
+static void test_hook(usart_port* port) {
+	test_hook_calls++;
+	test_hook_free = usart_tx_free(port);
+}
+
+static void test_tx_drain(void) {
+	while (usart_tx_free(TEST_PORT) < RBUFFER_SIZE || !(TEST_UNIT->STATUS & USART_TXCIF_bm)) {
+		sim_wait();
+	}
+}
+
+// try_write and try_send take what fits and say so; the short call arms the
+// hook, which fires once as the ring drains past the watermark
+static void test_tx_hook_watermark(void) {
+	char text[RBUFFER_SIZE + 8];
+	memset(text, 'w', sizeof(text));
+	test_start(TEST_CONFIG, USART_RX_DROP_NEWEST);
+	usart_set_tx_hook(TEST_PORT, TEST_WATERMARK, test_hook);
+	test_hook_calls = 0;
+	cli();
+	CHECK(usart_try_write(TEST_PORT, text, sizeof(text)) == RBUFFER_SIZE);
+	CHECK(usart_try_send(TEST_PORT, 'x') == 0);
+	sei();
+	test_tx_drain();
+	CHECK(test_hook_calls == 1);
+	CHECK(test_hook_free >= TEST_WATERMARK && test_hook_free <= TEST_WATERMARK + 1);
+	text[RBUFFER_SIZE] = 0;
+	CHECK(test_tx_log_is(text));					// Nothing of the short calls' rest
+}
+
+// A watermark of 0 never arms the hook
+static void test_tx_hook_off(void) {
+	char text[RBUFFER_SIZE + 8];
+	memset(text, 'w', sizeof(text));
+	test_start(TEST_CONFIG, USART_RX_DROP_NEWEST);
+	usart_set_tx_hook(TEST_PORT, 0, test_hook);
+	test_hook_calls = 0;
+	cli();
+	CHECK(usart_try_write(TEST_PORT, text, sizeof(text)) == RBUFFER_SIZE);
+	CHECK(usart_try_send(TEST_PORT, 'x') == 0);
+	sei();
+	test_tx_drain();
+	CHECK(test_hook_calls == 0);
+}
+
+// USART_STREAM_DROP drops what does not fit instead of waiting for room,
+// which with interrupts off would never come
+static void test_stream_drop(void) {
+	char text[RBUFFER_SIZE + 1];
+	test_start(TEST_CONFIG, USART_RX_DROP_NEWEST);
+	usart_set_stream_mode(TEST_PORT, USART_STREAM_DROP);
+	cli();
+	for (size_t i = 0; i < RBUFFER_SIZE + 8; i++) {
+		CHECK(TEST_STREAM->put('a' + i % 26, TEST_STREAM) == 0);
+	}
+	sei();
+	test_tx_drain();
+	for (size_t i = 0; i < RBUFFER_SIZE; i++) {
+		text[i] = 'a' + i % 26;
+	}
+	text[RBUFFER_SIZE] = 0;
+	CHECK(test_tx_log_is(text));
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// DEFERRED LOGGING
+// Records sent with USART_LOG are captured from the line and decoded by
+// tools/ulog_decode.py against this test binary, which is linked -no-pie so
+// the format addresses in its ELF are the ones the records carry. Arguments
+// stay within what AVR int and long hold, as the records pack them that way.
+static const char test_log_expect[] =
+	"boot\n"
+	"T=-5 C id=0xBEEF n=123456789\n"
+	"name=abc c=x v=1.500\n";
+
+static void test_log_roundtrip(const char* elf) {
+	test_start(TEST_CONFIG, USART_RX_DROP_NEWEST);
+	USART_LOG(TEST_PORT, "boot\n");
+	USART_LOG(TEST_PORT, "T=%d C id=0x%04X n=%lu\n", -5, 0xBEEFu, 123456789ul);
+	USART_LOG(TEST_PORT, "name=%s c=%c v=%.3f\n", "abc", 'x', 1.5f);
+	while (usart_tx_free(TEST_PORT) < RBUFFER_SIZE || !(TEST_UNIT->STATUS & USART_TXCIF_bm)) {
+		sim_wait();
+	}
+
+	char capture[] = "/tmp/ulog_test_XXXXXX";
+	int fd = mkstemp(capture);
+	size_t count;
+	const sim_byte_t* log = sim_tx_log(TEST_UNIT, &count);
+	for (size_t i = 0; i < count; i++) {
+		CHECK(write(fd, &log[i].data, 1) == 1);
+	}
+	close(fd);
+
+	char decoded[] = "/tmp/ulog_text_XXXXXX";		// host/stdio.h replaces FILE, so no popen
+	char command[256];
+	char text[256];
+	close(mkstemp(decoded));
+	snprintf(command, sizeof(command), "python3 tools/ulog_decode.py %s %s > %s", elf, capture, decoded);
+	int status = system(command);
+	fd = open(decoded, O_RDONLY);
+	ssize_t len = read(fd, text, sizeof(text) - 1);
+	close(fd);
+	unlink(capture);
+	unlink(decoded);
+	text[len > 0 ? len : 0] = 0;
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+		printf("test: python3 not found; log round trip skipped\n");
+		return;
+	}
+	CHECK(status == 0);
+	CHECK(!strcmp(text, test_log_expect));
+	if (strcmp(text, test_log_expect)) {
+		fprintf(stderr, "%s", text);
+	}
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// MAIN
+int main(int argc, char** argv) {
+	test_spsc_overrun(USART_RX_DROP_NEWEST);
+	test_spsc_overrun(USART_RX_DROP_OLDEST);
+	test_overflow_at_end();
+	test_overflow_keeps_errors();
+	test_flag_marks_full();
+	test_drop_oldest_flags();
+	test_frame_longer_than_ring();
+	test_gap_frames();
+	test_gap_expired_before_byte();
+	test_stream_nonblock();
+	test_stream_line();
+	test_stream_line_full();
+	test_stream_line_blocking();
+	test_stream_rx_stop();
+	test_stream_flagged();
+	test_address_ninth_bit();
+	test_address_filter();
+	test_autobaud_soft(100);
+	test_autobaud_soft(0);
+	test_autobaud_timeout();
+	test_config_raw();
+	test_close_interrupts_off();
+	test_tx_hook_watermark();
+	test_tx_hook_off();
+	test_stream_drop();
+	test_log_roundtrip(argv[0]);
+
+	if (test_failures) {
+		fprintf(stderr, "test: ring %d: %d checks failed\n", RBUFFER_SIZE, test_failures);
+		return EXIT_FAILURE;
+	}
+	printf("test: ring %d: all passed\n", RBUFFER_SIZE);
+	return EXIT_SUCCESS;
+}
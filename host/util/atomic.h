@@ -0,0 +1,41 @@
+/*
+ *     host/util/atomic.h
+ *
+ *          Project:  UART for ATmega4808
+ *          Author:   Hans-Henrik Fuxelius   
+ *          Date:     2023-05-08           
+ *
+ *  ATOMIC_BLOCK as in avr-libc, with a cleanup handler so break and return
+ *  leave the block correctly. It also holds the simulator CPU lock, which
+ *  keeps the interrupt thread of a threaded run out as cli would.
+ */
+
+#pragma once
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+void sim_cpu_lock(void);
+void sim_cpu_unlock(void);
+
+static inline uint8_t sim_atomic_enter(void) {
+    sim_cpu_lock();
+    uint8_t sreg = SREG;
+    cli();
+    return sreg;
+}
+
+static inline void sim_atomic_restore(const uint8_t* sreg) {
+    SREG = *sreg;
+    sim_cpu_unlock();
+}
+
+static inline void sim_atomic_forceon(const uint8_t* sreg) {
+    (void)sreg;
+    sei();
+    sim_cpu_unlock();
+}
+
+#define ATOMIC_RESTORESTATE  uint8_t sreg_save __attribute__((__cleanup__(sim_atomic_restore))) = sim_atomic_enter()
+#define ATOMIC_FORCEON       uint8_t sreg_save __attribute__((__cleanup__(sim_atomic_forceon))) = sim_atomic_enter()
+
+#define ATOMIC_BLOCK(type)   for (type, atomic_todo = 1; atomic_todo; atomic_todo = 0)
@@ -0,0 +1,15 @@
+/*
+ *     host/util/delay.h
+ *
+ *          Project:  UART for ATmega4808
+ *          Author:   Hans-Henrik Fuxelius   
+ *          Date:     2023-05-08           
+ *
+ *  Delays advance simulated time; interrupts are served meanwhile.
+ */
+
+#pragma once
+#include "sim.h"
+
+#define _delay_ms(ms)  sim_run((sim_time_t)((ms) * SIM_MS))
+#define _delay_us(us)  sim_run((sim_time_t)((us) * SIM_US))
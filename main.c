@@ -8,19 +8,30 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
-#include <util/delay.h>
 #include <stdio.h>
 #include "uart.h"
+#ifndef USART_TIMER
+#include <util/delay.h>
+#endif
 
 int main(void) {
 
+#ifdef USART_FRAME_QUEUE
+    char line[RBUFFER_SIZE];
+    uint16_t errors;
+    size_t len;
+#else
     uint16_t c;
+#endif
     uint8_t j=0;
 
     while (1) {
 
-        // (1) - Init USART
-        usart3_init((uint16_t)BAUD_RATE(9600));
+        // (1) - Init USART; the Rx interrupt assembles lines ending in CR
+        usart3_init(USART_CONFIG(9600, USART_FORMAT_8N1));
+#ifdef USART_FRAME_QUEUE
+        usart3_set_frame(USART_FRAME_DELIMITER, '\r', NULL);
+#endif
 
         // (2) - Enable global interrupts
         sei(); 
@@ -34,9 +45,33 @@ int main(void) {
         for(uint8_t i=0; i<5; i++) {
             // (5) - Use formatted fprintf to write to stream
             fprintf(&USART3_stream, "\r\nCounter value is: 0x%02X ", j++);
+
+            // (6) - Sleep until input arrived or 500 ms have passed, a whole line in frame mode
+#ifdef USART_TIMER
+            usart_wait_any(USART_WAIT_PORT(3), 500);
+#else
             _delay_ms(500);
+#endif
+
+#ifdef USART_FRAME_QUEUE
+            // (7) - Read the lines
+            while((len = usart3_read_frame(line, sizeof(line), &errors))) {
+
+                if (errors & USART_PARITY_ERROR) {
+                    fprintf(&USART3_stream, "USART PARITY ERROR: ");
+                }
+                if (errors & USART_FRAME_ERROR) {
+                    fprintf(&USART3_stream, "USART FRAME ERROR: ");
+                }
+                if (errors & USART_BUFFER_OVERFLOW) {
+                    fprintf(&USART3_stream, "USART BUFFER OVERFLOW ERROR: ");
+                }
 
-            // (6) - Get USART input by polling ringbuffer
+                // (8) - Echo the line to USART
+                usart3_write(line, (len < sizeof(line)) ? len : sizeof(line));
+            }
+#else
+            // (7) - Get USART input by polling ringbuffer
             while(!((c = usart3_read_char()) & USART_NO_DATA)) {
 
                 if (c & USART_PARITY_ERROR) {
@@ -49,18 +84,19 @@ int main(void) {
                     fprintf(&USART3_stream, "USART BUFFER OVERFLOW ERROR: ");
                 }
 
-                // (7) - Send single character to USART
+                // (8) - Send single character to USART
                 usart3_send_char((char)c);
             }
+#endif
         }
 
-        // (8) - Check that everything is printed before closing USART
+        // (9) - Check that everything is printed before closing USART
         fprintf(&USART3_stream, "\r\n\r\n<-<->->");
 
-        // (9) - Close USART0
+        // (10) - Close USART0
         usart3_close();    
 
-        // (10) - Clear global interrupts
+        // (11) - Clear global interrupts
         cli();
 
     }
@@ -0,0 +1,66 @@
+/*
+ *     profile/firmware.c
+ *
+ *          Project:  UART for ATmega4808
+ *          Author:   Hans-Henrik Fuxelius
+ *          Date:     2023-05-08
+ *
+ *  Firmware sized by `make size-ports`: every enabled port echoes what it
+ *  receives, so RXC and DRE both run at the line rate. The enabled ports come
+ *  from the Makefile.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdio.h>
+#include "uart.h"
+
+#ifndef PROFILE_BAUD
+#define PROFILE_BAUD 115200
+#endif
+
+#define PROFILE_CONFIG  USART_CONFIG(PROFILE_BAUD, USART_FORMAT_8N1)
+
+static void profile_echo(usart_port* port) {
+    const char* data;
+    size_t len = usart_rx_peek(port, &data);
+
+    if (len) {
+        usart_rx_commit(port, usart_try_write(port, data, len));
+    }
+    else {
+        usart_read_char(port);              // Drop a byte with error flags
+    }
+}
+
+int main(void) {
+
+#ifdef USART0_ENABLE
+    usart0_init(PROFILE_CONFIG);
+#endif
+#ifdef USART1_ENABLE
+    usart1_init(PROFILE_CONFIG);
+#endif
+#ifdef USART2_ENABLE
+    usart2_init(PROFILE_CONFIG);
+#endif
+#ifdef USART3_ENABLE
+    usart3_init(PROFILE_CONFIG);
+#endif
+    sei();
+
+    while (1) {
+#ifdef USART0_ENABLE
+        profile_echo(&USART0_port);
+#endif
+#ifdef USART1_ENABLE
+        profile_echo(&USART1_port);
+#endif
+#ifdef USART2_ENABLE
+        profile_echo(&USART2_port);
+#endif
+#ifdef USART3_ENABLE
+        profile_echo(&USART3_port);
+#endif
+    }
+}
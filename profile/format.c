@@ -0,0 +1,70 @@
+/*
+ *     profile/format.c
+ *
+ *          Project:  UART for ATmega4808
+ *          Author:   Hans-Henrik Fuxelius
+ *          Date:     2023-05-08
+ *
+ *  Firmware built by `make format-size`: writes the host/bench.c telemetry
+ *  line on USART3 through fprintf (FORMAT_PRINTF), through uart_format.c
+ *  (FORMAT_DIRECT) or both. avr-size of the variants gives the flash cost of
+ *  each path. TCB0 counts CLK_PER around each line, which starts on an empty
+ *  ring; the cycles of the last line are written after it with the same
+ *  formatter, and kept in format_cycles for a debugger or simavr.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdio.h>
+#include "uart.h"
+#include "uart_format.h"
+
+volatile uint16_t format_cycles[2];         // printf, direct
+
+static void format_wait_empty(void) {
+    while (usart_tx_free(&USART3_port) < RBUFFER_SIZE) {
+    }
+}
+
+static uint16_t format_start(void) {
+    format_wait_empty();
+    return TCB0.CNT;
+}
+
+int main(void) {
+    uint16_t temp = 2150;
+    uint16_t id = 0xBEEF;
+    uint32_t n = 0;
+    uint16_t t0;
+
+    TCB0.CCMP = 0xFFFF;
+    TCB0.CTRLA = TCB_CLKSEL_CLKDIV1_gc | TCB_ENABLE_bm;
+    usart3_init(USART_CONFIG(115200, USART_FORMAT_8N1));
+    sei();
+
+    while (1) {
+#ifdef FORMAT_PRINTF
+        t0 = format_start();
+        fprintf(&USART3_stream, "T=%u.%02u C id=0x%04X n=%lu\r\n", temp / 100, temp % 100, id, (unsigned long)n);
+        format_cycles[0] = TCB0.CNT - t0;
+        fprintf(&USART3_stream, "printf %u cycles\r\n", format_cycles[0]);
+#endif
+#ifdef FORMAT_DIRECT
+        t0 = format_start();
+        usart_put_str(&USART3_port, "T=");
+        usart_put_fixed(&USART3_port, temp, 2);
+        usart_put_str(&USART3_port, " C id=0x");
+        usart_put_hex16(&USART3_port, id);
+        usart_put_str(&USART3_port, " n=");
+        usart_put_u32(&USART3_port, n);
+        usart_put_str(&USART3_port, "\r\n");
+        format_cycles[1] = TCB0.CNT - t0;
+        usart_put_str(&USART3_port, "direct ");
+        usart_put_u16(&USART3_port, format_cycles[1]);
+        usart_put_str(&USART3_port, " cycles\r\n");
+#endif
+        n++;
+        temp = (temp + 7) % 10000;
+        id += 0x0101;
+    }
+}
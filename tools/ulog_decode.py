@@ -0,0 +1,152 @@
+#!/usr/bin/env python3
+#
+#     tools/ulog_decode.py
+#
+#          Project:  UART for ATmega4808
+#          Author:   Hans-Henrik Fuxelius
+#          Date:     2023-05-08
+#
+#  Turns USART_LOG records (uart_log.h) back into text.
+#
+#  Usage: ulog_decode.py firmware.elf [capture]
+#
+#  Reads the line bytes from capture, or from stdin, for example a serial port
+#  in raw mode. Every format string is a usart_log_fmt symbol in the ELF; its
+#  address is the record id. Frames that fail the CRC are shown as plain text,
+#  so ordinary output sent between records is kept.
+
+import re
+import struct
+import sys
+
+SLIP_END, SLIP_ESC, SLIP_ESC_END, SLIP_ESC_ESC = 0xC0, 0xDB, 0xDC, 0xDD
+
+# ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+# ELF
+def read_formats(path):
+    """Maps the low 16 bits of each usart_log_fmt address to its string."""
+    data = open(path, "rb").read()
+    if data[:4] != b"\x7fELF":
+        sys.exit("%s: not an ELF file" % path)
+    wide = data[4] == 2
+    end = "<" if data[5] == 1 else ">"
+    if wide:
+        shoff, = struct.unpack_from(end + "Q", data, 0x28)
+        shentsize, shnum = struct.unpack_from(end + "HH", data, 0x3A)
+        fmt = end + "IIQQQQIIQQ"
+    else:
+        shoff, = struct.unpack_from(end + "I", data, 0x20)
+        shentsize, shnum = struct.unpack_from(end + "HH", data, 0x2E)
+        fmt = end + "IIIIIIIIII"
+    sections = [struct.unpack_from(fmt, data, shoff + i * shentsize) for i in range(shnum)]
+
+    formats = {}
+    for symtab in (s for s in sections if s[1] == 2):        # SHT_SYMTAB
+        strtab = sections[symtab[6]]
+        entsize = symtab[9]
+        for off in range(symtab[4], symtab[4] + symtab[5], entsize):
+            if wide:
+                name, info, other, shndx, value, size = struct.unpack_from(end + "IBBHQQ", data, off)
+            else:
+                name, value, size, info, other, shndx = struct.unpack_from(end + "IIIBBH", data, off)
+            n = strtab[4] + name
+            sym = data[n:data.index(b"\0", n)].decode()
+            if not sym.startswith("usart_log_fmt") or not 0 < shndx < len(sections):
+                continue
+            sec = sections[shndx]
+            start = sec[4] + value - sec[3]
+            text = data[start:data.index(b"\0", start)]
+            formats[value & 0xFFFF] = text.decode("latin-1")
+    return formats
+
+# ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+# RECORDS
+def crc16(data):
+    crc = 0xFFFF
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+        crc &= 0xFFFF
+    return crc
+
+CONVERSION = re.compile(r"%([-+ #0]*)(\d+|\*)?(?:\.(\d+))?(hh|h|ll|l)?([diouxXcsfeEgGp%])")
+
+def format_record(fmt, args):
+    """printf with the arguments laid out as AVR varargs."""
+    out = []
+    pos = 0
+    last = 0
+    for m in CONVERSION.finditer(fmt):
+        out.append(fmt[last:m.start()])
+        last = m.end()
+        flags, width, prec, length, conv = m.groups()
+        if conv == "%":
+            out.append("%")
+            continue
+        spec = "%" + flags + (width or "") + ("." + prec if prec else "")
+        if conv == "s":
+            n = args.index(b"\0", pos)
+            out.append((spec + "s") % args[pos:n].decode("latin-1"))
+            pos = n + 1
+        elif conv in "feEgG":
+            value, = struct.unpack_from("<f", args, pos)
+            out.append((spec + conv) % value)
+            pos += 4
+        else:
+            size = 4 if length in ("l", "ll") else 2
+            value = int.from_bytes(args[pos:pos + size], "little", signed=conv in "di")
+            pos += size
+            if conv == "c":
+                out.append((spec + "c") % chr(value & 0xFF))
+            elif conv == "p":
+                out.append("0x%04x" % value)
+            else:
+                out.append((spec + conv.replace("u", "d")) % value)
+    out.append(fmt[last:])
+    return "".join(out)
+
+def decode_frame(frame, formats):
+    if len(frame) >= 4 and crc16(frame) == 0:
+        ident = frame[0] | frame[1] << 8
+        if ident in formats:
+            try:
+                return format_record(formats[ident], frame[2:-2])
+            except (ValueError, struct.error, IndexError):
+                return "<record 0x%04x: arguments do not match \"%s\">\n" % (ident, formats[ident])
+        return "<record 0x%04x: unknown format>\n" % ident
+    return frame.decode("latin-1")
+
+def frames(stream):
+    frame = bytearray()
+    escape = False
+    while True:
+        chunk = stream.read1(4096) if hasattr(stream, "read1") else stream.read(4096)
+        if not chunk:
+            break
+        for b in chunk:
+            if b == SLIP_END:
+                if frame:
+                    yield bytes(frame)
+                frame.clear()
+            elif b == SLIP_ESC:
+                escape = True
+            else:
+                if escape:
+                    b = {SLIP_ESC_END: SLIP_END, SLIP_ESC_ESC: SLIP_ESC}.get(b, b)
+                    escape = False
+                frame.append(b)
+    if frame:
+        yield bytes(frame)
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        sys.exit("usage: %s firmware.elf [capture]" % sys.argv[0])
+    formats = read_formats(sys.argv[1])
+    stream = open(sys.argv[2], "rb") if len(sys.argv) == 3 else sys.stdin.buffer
+    for frame in frames(stream):
+        sys.stdout.write(decode_frame(frame, formats))
+        sys.stdout.flush()
+
+if __name__ == "__main__":
+    main()
@@ -7,547 +7,1723 @@
  */
 
 #include <util/atomic.h>
+#include <avr/sleep.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
-#include <util/delay.h>
 #include "uart_settings.h"
 #include "uart.h"
 
 #define USART_RX_ERROR_MASK (USART_BUFOVF_bm | USART_FERR_bm | USART_PERR_bm) // [Datasheet ss. 295]
 
+// Per-byte RX status bits; a byte may carry several
+#define USART_RX_OK              0x00
+#define USART_RX_PARITY          0x01
+#define USART_RX_FRAME           0x02
+#define USART_RX_OVERFLOW        0x04        // Hardware overrun or data lost to a full ring
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// REGISTER ACCESS & WAITING
+// Register accesses with side effects and blocking waits go through these, so
+// the host build (host/) can run the driver against a simulated unit
+#ifndef USART_RXDATAL_READ
+#define USART_RXDATAL_READ(usart)          ((usart)->RXDATAL)         // Pops the receive FIFO
+#endif
+#ifndef USART_TXDATAL_WRITE
+#define USART_TXDATAL_WRITE(usart, data)   ((usart)->TXDATAL = (data))
+#endif
+#ifndef USART_TXDATAH_WRITE
+#define USART_TXDATAH_WRITE(usart, data)   ((usart)->TXDATAH = (data))  // Ignored while DREIF is clear
+#endif
+#ifndef USART_STATUS_WRITE
+#define USART_STATUS_WRITE(usart, bm)      ((usart)->STATUS = (bm))   // Flags are cleared by writing one
+#endif
+#ifndef USART_INTFLAGS_WRITE
+#define USART_INTFLAGS_WRITE(tcb, bm)      ((tcb)->INTFLAGS = (bm))   // Timer flags, the same
+#endif
+#ifndef USART_PIN_READ
+#define USART_PIN_READ(port)               ((port)->IN)
+#endif
+#ifndef USART_WAIT_WHILE
+// Blocking waits sleep in IDLE and are woken by the interrupt that ends them.
+// The condition is tested with interrupts off and sei is directly followed by
+// sleep, so that interrupt cannot slip in between the test and the sleep.
+// Called with interrupts off nothing could end the wait, so it spins as before;
+// waits that must end then, as in usart_close, poll hardware flags instead.
+static inline void usart_idle(uint8_t sreg) {
+	if (sreg & CPU_I_bm) {
+		uint8_t sleep_ctrl = SLPCTRL.CTRLA;			// Keep the application's sleep mode
+		set_sleep_mode(SLEEP_MODE_IDLE);
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		SLPCTRL.CTRLA = sleep_ctrl;
+		cli();
+	}
+}
+
+#define USART_WAIT_WHILE(cond) \
+	do { uint8_t usart_sreg = SREG; cli(); while (cond) usart_idle(usart_sreg); SREG = usart_sreg; } while (0)
+#endif
+#ifndef USART_POLL_WHILE
+#define USART_POLL_WHILE(cond)             while (cond)               // Busy wait on a hardware flag
+#endif
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// RINGBUFFER SIZES; ports without their own size use RBUFFER_SIZE
+#ifndef USART0_RX_BUFFER_SIZE
+#define USART0_RX_BUFFER_SIZE RBUFFER_SIZE
+#endif
+#ifndef USART0_TX_BUFFER_SIZE
+#define USART0_TX_BUFFER_SIZE RBUFFER_SIZE
+#endif
+#ifndef USART1_RX_BUFFER_SIZE
+#define USART1_RX_BUFFER_SIZE RBUFFER_SIZE
+#endif
+#ifndef USART1_TX_BUFFER_SIZE
+#define USART1_TX_BUFFER_SIZE RBUFFER_SIZE
+#endif
+#ifndef USART2_RX_BUFFER_SIZE
+#define USART2_RX_BUFFER_SIZE RBUFFER_SIZE
+#endif
+#ifndef USART2_TX_BUFFER_SIZE
+#define USART2_TX_BUFFER_SIZE RBUFFER_SIZE
+#endif
+#ifndef USART3_RX_BUFFER_SIZE
+#define USART3_RX_BUFFER_SIZE RBUFFER_SIZE
+#endif
+#ifndef USART3_TX_BUFFER_SIZE
+#define USART3_TX_BUFFER_SIZE RBUFFER_SIZE
+#endif
+#ifndef USART4_RX_BUFFER_SIZE
+#define USART4_RX_BUFFER_SIZE RBUFFER_SIZE
+#endif
+#ifndef USART4_TX_BUFFER_SIZE
+#define USART4_TX_BUFFER_SIZE RBUFFER_SIZE
+#endif
+#ifndef USART5_RX_BUFFER_SIZE
+#define USART5_RX_BUFFER_SIZE RBUFFER_SIZE
+#endif
+#ifndef USART5_TX_BUFFER_SIZE
+#define USART5_TX_BUFFER_SIZE RBUFFER_SIZE
+#endif
+
+// Free running indices must hold 2 * size, so one byte covers sizes up to 128
+#if (defined(USART0_ENABLE) && (USART0_RX_BUFFER_SIZE > 128 || USART0_TX_BUFFER_SIZE > 128)) || \
+    (defined(USART1_ENABLE) && (USART1_RX_BUFFER_SIZE > 128 || USART1_TX_BUFFER_SIZE > 128)) || \
+    (defined(USART2_ENABLE) && (USART2_RX_BUFFER_SIZE > 128 || USART2_TX_BUFFER_SIZE > 128)) || \
+    (defined(USART3_ENABLE) && (USART3_RX_BUFFER_SIZE > 128 || USART3_TX_BUFFER_SIZE > 128)) || \
+    (defined(USART4_ENABLE) && (USART4_RX_BUFFER_SIZE > 128 || USART4_TX_BUFFER_SIZE > 128)) || \
+    (defined(USART5_ENABLE) && (USART5_RX_BUFFER_SIZE > 128 || USART5_TX_BUFFER_SIZE > 128))
+#define RBUFFER_WIDE_INDEX
+typedef uint16_t rbuffer_index_t;
+#else
+typedef uint8_t rbuffer_index_t;
+#endif
+
+#define RBUFFER_SIZE_MAX 2048
+
+_Static_assert(USART_RX_MARKS >= 2 && USART_RX_MARKS <= 128 && (USART_RX_MARKS & (USART_RX_MARKS - 1)) == 0,
+	"USART_RX_MARKS must be a power of two from 2 to 128");
+
+#ifdef USART_FRAME_QUEUE
+_Static_assert(USART_FRAME_QUEUE >= 2 && USART_FRAME_QUEUE <= 8 && (USART_FRAME_QUEUE & (USART_FRAME_QUEUE - 1)) == 0,
+	"USART_FRAME_QUEUE must be 2, 4 or 8");
+#endif
+
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
 // RINGBUFFER STRUCT
+// Single producer, single consumer: the producer only ever writes `in` and the
+// consumer only ever writes `out`. Both indices run freely and are masked on
+// access, so the fill level is their difference and no lock is needed.
 typedef struct { 
-    volatile char     buffer[RBUFFER_SIZE];     
-    volatile uint8_t  in;                           
-    volatile uint8_t  out;                          
-    volatile uint8_t  count;         
+    char*                     buffer;
+    rbuffer_index_t           mask;             // Size - 1
+    volatile rbuffer_index_t  in;               // Written by producer only
+    volatile rbuffer_index_t  out;              // Written by consumer only
 } ringbuffer;
 
+// Defines a ring and its storage; the size is checked at compile time
+#define RBUFFER_DEFINE(name, size) \
+	_Static_assert((size) >= 2 && (size) <= RBUFFER_SIZE_MAX && ((size) & ((size) - 1)) == 0, \
+		#size " must be a power of two from 2 to 2048"); \
+	static char name##_buffer[size]; \
+	ringbuffer name = { name##_buffer, (size) - 1, 0, 0 }
+
+// Compiler barrier; keeps buffer accesses ordered against the index updates
+#define rbuffer_barrier() __asm__ __volatile__ ("" ::: "memory")
+
+// A two byte index is not loaded or stored in one instruction on AVR, so
+// indices shared with the other side are accessed atomically when wide
+#ifdef RBUFFER_WIDE_INDEX
+static inline rbuffer_index_t rbuffer_get(volatile rbuffer_index_t* index) {
+	rbuffer_index_t value;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		value = *index;
+	}
+	return value;
+}
+
+static inline void rbuffer_set(volatile rbuffer_index_t* index, rbuffer_index_t value) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		*index = value;
+	}
+}
+#else
+#define rbuffer_get(index)          (*(index))
+#define rbuffer_set(index, value)   (*(index) = (value))
+#endif
+
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
 // RINGBUFFER FUNCTIONS
-void rbuffer_init(volatile ringbuffer* rb) {
-	rb->in = 0;
-	rb->out = 0;
-	rb->count = 0;
+static inline void rbuffer_init(ringbuffer* rb) {
+	rbuffer_set(&rb->in, 0);
+	rbuffer_set(&rb->out, 0);
 }
 
-uint8_t rbuffer_count(volatile ringbuffer* rb) {
-	return rb->count;
+static inline rbuffer_index_t rbuffer_count(ringbuffer* rb) {
+	return (rbuffer_index_t)(rbuffer_get(&rb->in) - rbuffer_get(&rb->out));
 }
 
-bool rbuffer_full(volatile ringbuffer* rb) {
-	return (rb->count == (uint8_t)RBUFFER_SIZE);
+static inline bool rbuffer_full(ringbuffer* rb) {
+	return (rbuffer_count(rb) > rb->mask);
 }
 
-bool rbuffer_empty(volatile ringbuffer* rb) {
-	return (rb->count == 0);
+static inline size_t rbuffer_size(ringbuffer* rb) {
+	return (size_t)rb->mask + 1;
 }
 
-void rbuffer_insert(char data, volatile ringbuffer* rb) {   
-	*(rb->buffer + rb->in) = data;
-	rb->in = (rb->in + 1) & ((uint8_t)RBUFFER_SIZE - 1);
-	rb->count++;
+static inline rbuffer_index_t rbuffer_free(ringbuffer* rb) {
+	return (rbuffer_index_t)(rbuffer_size(rb) - rbuffer_count(rb));
 }
 
-char rbuffer_remove(volatile ringbuffer* rb) {
-	char data = *(rb->buffer + rb->out);
-	rb->out = (rb->out + 1) & ((uint8_t)RBUFFER_SIZE - 1);
-	rb->count--;
+static inline bool rbuffer_empty(ringbuffer* rb) {
+	return (rbuffer_count(rb) == 0);
+}
+
+// Producer side only
+static inline void rbuffer_insert(char data, ringbuffer* rb) {   
+	rbuffer_index_t in = rb->in;
+	rb->buffer[in & rb->mask] = data;
+	rbuffer_barrier();								// Data before index
+	rbuffer_set(&rb->in, in + 1);
+}
+
+// Consumer side only
+static inline char rbuffer_remove(ringbuffer* rb) {
+	rbuffer_index_t out = rb->out;
+	rbuffer_barrier();								// Index check before data
+	char data = rb->buffer[out & rb->mask];
+	rbuffer_barrier();								// Data before index
+	rbuffer_set(&rb->out, out + 1);
 	return data;
 }
 
+// Producer side only; copies what fits in at most two chunks around the wrap
+// point and publishes them with a single index update
+static inline rbuffer_index_t rbuffer_write(ringbuffer* rb, const char* data, size_t len) {
+	rbuffer_index_t in = rb->in;
+	rbuffer_index_t space = rb->mask + 1 - (rbuffer_index_t)(in - rbuffer_get(&rb->out));
+	if (len > space) {
+		len = space;
+	}
+	rbuffer_index_t head = in & rb->mask;
+	rbuffer_index_t chunk = rb->mask + 1 - head;
+	if (chunk > len) {
+		chunk = len;
+	}
+	memcpy(rb->buffer + head, data, chunk);
+	memcpy(rb->buffer, data + chunk, len - chunk);
+	rbuffer_barrier();								// Data before index
+	rbuffer_set(&rb->in, in + len);
+	return len;
+}
+
+// Producer side only; longest contiguous free span starting at `in`
+static inline rbuffer_index_t rbuffer_reserve(ringbuffer* rb, char** data) {
+	rbuffer_index_t in = rb->in;
+	rbuffer_index_t space = rb->mask + 1 - (rbuffer_index_t)(in - rbuffer_get(&rb->out));
+	rbuffer_index_t head = in & rb->mask;
+	rbuffer_index_t chunk = rb->mask + 1 - head;
+	*data = rb->buffer + head;
+	return (space < chunk) ? space : chunk;
+}
+
+// Producer side only; publishes len bytes written after rbuffer_reserve
+static inline void rbuffer_publish(ringbuffer* rb, size_t len) {
+	rbuffer_barrier();								// Data before index
+	rbuffer_set(&rb->in, rb->in + len);
+}
+
+// Consumer side only; longest contiguous readable span starting at `out`
+static inline rbuffer_index_t rbuffer_peek(ringbuffer* rb, const char** data) {
+	rbuffer_index_t out = rb->out;
+	rbuffer_index_t count = (rbuffer_index_t)(rbuffer_get(&rb->in) - out);
+	rbuffer_index_t tail = out & rb->mask;
+	rbuffer_index_t chunk = rb->mask + 1 - tail;
+	rbuffer_barrier();								// Index check before data
+	*data = rb->buffer + tail;
+	return (count < chunk) ? count : chunk;
+}
+
+// Consumer side only; releases len bytes previously returned by rbuffer_peek
+static inline void rbuffer_commit(ringbuffer* rb, size_t len) {
+	rbuffer_index_t out = rb->out;
+	rbuffer_index_t count = (rbuffer_index_t)(rbuffer_get(&rb->in) - out);
+	if (len > count) {
+		len = count;
+	}
+	rbuffer_barrier();								// Data before index
+	rbuffer_set(&rb->out, out + len);
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// PORT DESCRIPTOR
+// A received byte that carries status bits, see RX FLAGS
+typedef struct {
+	rbuffer_index_t   index;                    // RX ring index of the byte
+	uint8_t           code;                     // USART_RX_* bits
+} usart_rx_mark;
+
+// Everything the generic driver needs to know about one USART unit
+struct usart_port {
+	USART_t*          usart;                    // Hardware unit
+	ringbuffer*       rx;                       // Receive
+	ringbuffer*       tx;                       // Transmit
+	void            (*port_init)(void);         // Defined in uart_settings.h
+	FILE*             stream;                   // Stdio stream of this port
+	uint8_t           stream_mode;              // USART_STREAM_*
+	rbuffer_index_t   stream_eol;               // RX `out` after the line released by USART_STREAM_LINE
+	rbuffer_index_t   stream_scan;              // RX `out` up to which no '\n' was found
+	usart_tx_hook     tx_hook;                  // Called from DRE ISR when space frees up
+	rbuffer_index_t   tx_watermark;             // Free TX bytes that trigger tx_hook
+	volatile bool     tx_hook_armed;            // Set by a short try_* call
+	usart_rx_mark*    rx_marks;                 // USART_RX_MARKS flagged bytes, see RX FLAGS
+	volatile uint8_t  rx_mark_in;               // Marks added by the ISR
+	volatile uint8_t  rx_mark_out;              // Marks consumed by the reader
+	uint8_t           rx_policy;                // What a full RX ring does with new data
+	volatile bool     rx_lost;                  // Data was dropped; flag the next byte stored
+	volatile bool     rx_dropped;               // USART_RX_DROP_OLDEST dropped data; flag the byte at `out`
+	volatile bool     rx_stopped;               // Receiver stopped by USART_RX_STOP
+	bool              rx_filter;                // Address frames select this node, see usart_set_address
+	uint8_t           rx_address;
+	uint8_t           rx_broadcast;
+	PORT_t*           xdir_port;                // Driven by the unit with USART_OPTION_RS485
+	uint8_t           xdir_pin;
+	bool              tx_started;               // Something was sent since init
+	bool              tx_data8;                 // TXDATAH still holds an address bit
+	volatile bool     closing;                  // Close waits for the TXC interrupt
+	usart_close_hook  close_hook;               // Called from TXC ISR once closed
+#ifdef USART_FRAME_QUEUE
+	uint8_t           frame_mode;               // USART_FRAME_*
+	rbuffer_index_t   frame_value;              // Delimiter or fixed length
+	rbuffer_index_t   frame_count;              // Bytes of the frame being received; ISR only
+	usart_frame_hook  frame_hook;               // Called from RXC ISR per complete frame
+	volatile rbuffer_index_t frame_end[USART_FRAME_QUEUE];	// RX `in` after each queued frame
+	volatile uint8_t  frame_in;                 // Written by the ISR only
+	volatile uint8_t  frame_out;                // Written by the reader only
+	volatile uint8_t  frame_merged;             // Queue slots holding more than one frame, or a truncated one
+	volatile uint16_t frame_time[USART_FRAME_QUEUE];	// USART_TIMESTAMP at each frame end
+	TCB_t*            gap_timer;                // Times the silence ending a USART_FRAME_GAP frame
+	uint8_t           gap_ctrla;                // Clock and enable; written by each byte to restart
+#endif
+#ifdef USART_TIMER
+	PORT_t*           rx_port;                  // Rx pin, timed by software auto-baud
+	uint8_t           rx_pin;
+#endif
+#ifdef USART_STATS_ENABLE
+	usart_stats_t     stats;                    // Read through usart_get_stats
+#endif
+};
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// STATISTICS; compiled out unless USART_STATS_ENABLE is defined
+#ifdef USART_STATS_ENABLE
+#define USART_STAT_ADD(port, field, n)   ((port)->stats.field += (n))
+#define USART_STAT_MAX(port, field, v)   do { if ((v) > (port)->stats.field) (port)->stats.field = (v); } while (0)
+#else
+#define USART_STAT_ADD(port, field, n)   ((void)0)
+#define USART_STAT_MAX(port, field, v)   ((void)0)
+#endif
+
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-// RINGBUFFERS & VARIABLES
+// RINGBUFFERS & PORTS
+static int usart_print_char(char c, FILE *stream);
+static int usart_get_char(FILE *stream);
+
+#ifdef USART_TIMER
+#define USART_PORT_RX_PIN(n)  .rx_port = &USART##n##_RX_PORT, .rx_pin = USART##n##_RX_PIN_bm,
+#else
+#define USART_PORT_RX_PIN(n)
+#endif
+
+#ifdef USART_FRAME_QUEUE
+#define USART_PORT_GAP(n)     .gap_timer = USART##n##_GAP,
+#else
+#define USART_PORT_GAP(n)
+#endif
+
+#ifdef USART0_GAP_TIMER
+#define USART0_GAP  &USART0_GAP_TIMER
+#else
+#define USART0_GAP  NULL
+#endif
+#ifdef USART1_GAP_TIMER
+#define USART1_GAP  &USART1_GAP_TIMER
+#else
+#define USART1_GAP  NULL
+#endif
+#ifdef USART2_GAP_TIMER
+#define USART2_GAP  &USART2_GAP_TIMER
+#else
+#define USART2_GAP  NULL
+#endif
+#ifdef USART3_GAP_TIMER
+#define USART3_GAP  &USART3_GAP_TIMER
+#else
+#define USART3_GAP  NULL
+#endif
+#ifdef USART4_GAP_TIMER
+#define USART4_GAP  &USART4_GAP_TIMER
+#else
+#define USART4_GAP  NULL
+#endif
+#ifdef USART5_GAP_TIMER
+#define USART5_GAP  &USART5_GAP_TIMER
+#else
+#define USART5_GAP  NULL
+#endif
+
+#define USART_PORT_DEFINE(n) \
+	RBUFFER_DEFINE(rb_rx##n, USART##n##_RX_BUFFER_SIZE); \
+	RBUFFER_DEFINE(rb_tx##n, USART##n##_TX_BUFFER_SIZE); \
+	static usart_rx_mark rb_rx##n##_marks[USART_RX_MARKS]; \
+	FILE USART##n##_stream = FDEV_SETUP_STREAM(usart_print_char, usart_get_char, _FDEV_SETUP_RW); \
+	usart_port USART##n##_port = { \
+		.usart = &USART##n, .rx = &rb_rx##n, .tx = &rb_tx##n, \
+		.port_init = usart##n##_port_init, .stream = &USART##n##_stream, \
+		.xdir_port = &USART##n##_XDIR_PORT, .xdir_pin = USART##n##_XDIR_PIN_bm, \
+		USART_PORT_RX_PIN(n) \
+		USART_PORT_GAP(n) \
+		.rx_marks = rb_rx##n##_marks }
+
 #ifdef USART0_ENABLE
-volatile ringbuffer rb_rx0;		// Receive 
-volatile ringbuffer rb_tx0;		// Transmit
-volatile uint8_t usart0_error;	// Holds error from RXDATAH
+USART_PORT_DEFINE(0);
 #endif
 
 #ifdef USART1_ENABLE
-volatile ringbuffer rb_rx1;		// Receive 
-volatile ringbuffer rb_tx1;		// Transmit
-volatile uint8_t usart1_error;	// Holds error from RXDATAH
+USART_PORT_DEFINE(1);
 #endif
 
 #ifdef USART2_ENABLE
-volatile ringbuffer rb_rx2;		// Receive 
-volatile ringbuffer rb_tx2;		// Transmit
-volatile uint8_t usart2_error;	// Holds error from RXDATAH
+USART_PORT_DEFINE(2);
 #endif
 
 #ifdef USART3_ENABLE
-volatile ringbuffer rb_rx3;		// Receive 
-volatile ringbuffer rb_tx3;		// Transmit
-volatile uint8_t usart3_error;	// Holds error from RXDATAH
+USART_PORT_DEFINE(3);
 #endif
 
 #ifdef USART4_ENABLE
-volatile ringbuffer rb_rx4;		// Receive 
-volatile ringbuffer rb_tx4;		// Transmit
-volatile uint8_t usart4_error;	// Holds error from RXDATAH
+USART_PORT_DEFINE(4);
 #endif
 
 #ifdef USART5_ENABLE
-volatile ringbuffer rb_rx5;		// Receive 
-volatile ringbuffer rb_tx5;		// Transmit
-volatile uint8_t usart5_error;	// Holds error from RXDATAH
+USART_PORT_DEFINE(5);
 #endif
 
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-// USART0 FUNCTIONS
-#ifdef USART0_ENABLE
-void usart0_send_char(char c) {
-	while(rbuffer_full(&rb_tx0));
-	rbuffer_insert(c, &rb_tx0);
-	USART0.CTRLA |= USART_DREIE_bm;					// Enable Tx interrupt 
+// RX FLAGS
+// Bytes that arrived damaged, or after lost data, are marked so a reader can
+// drop exactly those. The ISR appends a mark with the ring index and status
+// bits of each such byte, in arrival order, and the reader takes the oldest
+// once it reaches that byte; RAM grows with USART_RX_MARKS, not the ring. A
+// byte that finds no mark free is dropped like one that finds the ring full.
+// Bytes dropped under USART_RX_DROP_OLDEST take their mark with them and
+// leave rx_dropped for the new oldest byte.
+#define USART_RX_MARK(i)   ((i) & (USART_RX_MARKS - 1))
+
+static inline bool usart_rx_flags_pending(usart_port* port) {
+	return port->rx_mark_in != port->rx_mark_out;
 }
 
-int usart0_print_char(char c, FILE *stream) { 
-    usart0_send_char(c);							
-    return 0; 
+// Status bits of the byte at index, which is at `out` or after it
+static inline uint8_t usart_rx_flag(usart_port* port, rbuffer_index_t index) {
+	if (usart_rx_flags_pending(port)) {
+		rbuffer_barrier();							// Count before mark
+		usart_rx_mark* mark = &port->rx_marks[USART_RX_MARK(port->rx_mark_out)];
+		if (mark->index == index) {
+			return mark->code;
+		}
+	}
+	return USART_RX_OK;
 }
 
-FILE USART0_stream = FDEV_SETUP_STREAM(usart0_print_char, NULL, _FDEV_SETUP_WRITE);
+// ISR side only; marks the byte about to be stored at index, false if no mark is free
+static inline bool usart_rx_set_flag(usart_port* port, rbuffer_index_t index, uint8_t code) {
+	uint8_t in = port->rx_mark_in;
+	if ((uint8_t)(in - port->rx_mark_out) >= USART_RX_MARKS) {
+		return false;
+	}
+	port->rx_marks[USART_RX_MARK(in)] = (usart_rx_mark){ index, code };
+	rbuffer_barrier();								// Mark before count
+	port->rx_mark_in = in + 1;
+	return true;
+}
 
-void usart0_init(uint16_t baud_rate) {
-	rbuffer_init(&rb_rx0);							// Init RX0 buffer
-	rbuffer_init(&rb_tx0);							// Init TX0 buffer
-	
-	usart0_port_init();								// Defined in uart_settings.h
+// Reader side, or the ISR when it owns `out` under USART_RX_DROP_OLDEST;
+// drops the oldest mark
+static inline void usart_rx_clear_flag(usart_port* port) {
+	port->rx_mark_out++;
+}
 
-    USART0.BAUD = baud_rate; 						// Set BAUD rate
-	USART0.CTRLB |= USART_RXEN_bm | USART_TXEN_bm; 	// Enable Rx & Enable Tx 
-	USART0.CTRLA |= USART_RXCIE_bm ; 				// Enable Rx interrupt 
+// Status bits for the error bits of RXDATAH
+static inline uint8_t usart_rx_status(uint8_t rxdatah) {
+	uint8_t code = USART_RX_OK;
+	if (rxdatah & USART_RX_ERROR_MASK) {
+		if (rxdatah & USART_PERR_bm) {
+			code |= USART_RX_PARITY;
+		}
+		if (rxdatah & USART_FERR_bm) {
+			code |= USART_RX_FRAME;
+		}
+		if (rxdatah & USART_BUFOVF_bm) {
+			code |= USART_RX_OVERFLOW;
+		}
+	}
+	return code;
 }
 
-void usart0_send_string(char* str, uint8_t len) {
-	for (size_t i=0; i<len; i++) {
-		usart0_send_char(str[i]);
+// Number of leading bytes among the next n that carry no flag
+static rbuffer_index_t usart_rx_unflagged(usart_port* port, rbuffer_index_t n) {
+	if (port->rx_dropped) {
+		return 0;
 	}
+	if (usart_rx_flags_pending(port)) {
+		rbuffer_barrier();							// Count before mark
+		rbuffer_index_t before = port->rx_marks[USART_RX_MARK(port->rx_mark_out)].index - port->rx->out;
+		if (before < n) {
+			return before;
+		}
+	}
+	return n;
 }
 
-uint16_t usart0_read_char(void) {
-	if (!rbuffer_empty(&rb_rx0)) {
-		return (((usart0_error & USART_RX_ERROR_MASK) << 8) | (uint16_t)rbuffer_remove(&rb_rx0));
+// Full RX ring; applies the port policy and returns true if the new byte is to be stored
+static bool usart_rx_overflow(usart_port* port, USART_t* usart, ringbuffer* rx) {
+	USART_STAT_ADD(port, rx_dropped, 1);
+	switch (port->rx_policy) {
+	case USART_RX_DROP_OLDEST: {
+		rbuffer_index_t out = rx->out;
+		if (usart_rx_flag(port, out)) {
+			usart_rx_clear_flag(port);				// Its mark goes with it
+		}
+		rbuffer_set(&rx->out, out + 1);				// The reader is atomic in this mode
+		port->rx_dropped = true;					// New oldest byte follows lost data
+		return true;
 	}
-	else {
-		return (((usart0_error & USART_RX_ERROR_MASK) << 8) | USART_NO_DATA);		// Empty ringbuffer
+	case USART_RX_STOP:
+		port->rx_stopped = true;
+		usart->CTRLA &= ~USART_RXCIE_bm;			// Stop receiving until usart_rx_resume
+		return false;
+	default:
+		port->rx_lost = true;						// Flag the next byte stored
+		return false;
 	}
 }
 
-// Disable unit Tx and Rx before its interrupts!
-void usart0_close(void) {
-	while(!rbuffer_empty(&rb_tx0)); 				// Wait for Tx to finish all character in ring buffer
-	while(!(USART0.STATUS & USART_DREIF_bm)); 		// Wait for Tx unit to finish the last character of ringbuffer
+// Empties the RX ring and its flags; the receiver interrupt must be off
+static void usart_rx_reset(usart_port* port) {
+	rbuffer_init(port->rx);
+	port->rx_mark_in = 0;
+	port->rx_mark_out = 0;
+	port->rx_lost = false;
+	port->rx_dropped = false;
+	port->rx_stopped = false;
+	port->stream_eol = 0;
+	port->stream_scan = 0;
+#ifdef USART_FRAME_QUEUE
+	port->frame_count = 0;
+	port->frame_in = 0;
+	port->frame_out = 0;
+	port->frame_merged = 0;
+#endif
+}
 
-	_delay_ms(200); 								// Extra safety for Tx to finish!
+void usart_set_rx_policy(usart_port* port, uint8_t policy) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		port->rx_policy = policy;
+	}
+}
 
-	USART0.CTRLB &= ~USART_RXEN_bm; 				// Disable Rx unit
-	USART0.CTRLB &= ~USART_TXEN_bm; 				// Disable Rx unit
+void usart_rx_resume(usart_port* port) {
+	USART_t* usart = port->usart;
 
-	USART0.CTRLA &= ~USART_RXCIE_bm;				// Disable Rx interrupt
-	USART0.CTRLA &= ~USART_DREIE_bm;				// Disable Tx interrupt
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		while (usart->STATUS & USART_RXCIF_bm) {
+			(void)USART_RXDATAL_READ(usart);	// Discard what arrived while stopped
+		}
+		port->rx_stopped = false;
+		usart->CTRLA |= USART_RXCIE_bm;				// Enable Rx interrupt
+	}
 }
-#endif
 
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-// USART1 FUNCTIONS
-#ifdef USART1_ENABLE
-void usart1_send_char(char c) {
-	while(rbuffer_full(&rb_tx1));
-	rbuffer_insert(c, &rb_tx1);
-	USART1.CTRLA |= USART_DREIE_bm;					// Enable Tx interrupt
+// TX BACKPRESSURE
+// A try_* call that comes up short arms the hook; the DRE ISR fires it once the
+// free space in the TX ring has grown back to the watermark
+static void usart_arm_tx_hook(usart_port* port) {
+	if (port->tx_hook) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			port->tx_hook_armed = (rbuffer_free(port->tx) < port->tx_watermark);
+		}
+	}
 }
 
-int usart1_print_char(char c, FILE *stream) { 
-    usart1_send_char(c);							
-    return 0; 
+void usart_set_tx_hook(usart_port* port, size_t watermark, usart_tx_hook hook) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		port->tx_hook = hook;
+		port->tx_watermark = (watermark > rbuffer_size(port->tx)) ? rbuffer_size(port->tx) : watermark;
+		port->tx_hook_armed = false;
+	}
 }
 
-FILE USART1_stream = FDEV_SETUP_STREAM(usart1_print_char, NULL, _FDEV_SETUP_WRITE);
-
-void usart1_init(uint16_t baud_rate) {
-	rbuffer_init(&rb_rx1);							// Init RX1 buffer
-	rbuffer_init(&rb_tx1);							// Init TX1 buffer
-	
-	usart1_port_init();								// Defined in uart_settings.h
-
-    USART1.BAUD = baud_rate; 						// Set BAUD rate
-	USART1.CTRLB |= USART_RXEN_bm | USART_TXEN_bm; 	// Enable Rx & Enable Tx 
-	USART1.CTRLA |= USART_RXCIE_bm ; 				// Enable Rx interrupt 
+size_t usart_tx_free(usart_port* port) {
+	return rbuffer_free(port->tx);
 }
 
-void usart1_send_string(char* str, uint8_t len) {
-	for (size_t i=0; i<len; i++) {
-		usart1_send_char(str[i]);
+#ifdef USART_STATS_ENABLE
+void usart_get_stats(usart_port* port, usart_stats_t* stats) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		*stats = port->stats;
 	}
 }
 
-uint16_t usart1_read_char(void) {
-	if (!rbuffer_empty(&rb_rx1)) {
-		return (((usart1_error & USART_RX_ERROR_MASK) << 8) | (uint16_t)rbuffer_remove(&rb_rx1));
-	}
-	else {
-		return (((usart1_error & USART_RX_ERROR_MASK) << 8) | USART_NO_DATA);		// Empty ringbuffer
+void usart_reset_stats(usart_port* port) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		memset(&port->stats, 0, sizeof(port->stats));
 	}
 }
+#endif
 
-// Disable unit Tx and Rx before its interrupts!
-void usart1_close(void) {
-	while(!rbuffer_empty(&rb_tx1)); 				// Wait for Tx to finish all character in ring buffer
-	while(!(USART1.STATUS & USART_DREIF_bm)); 		// Wait for Tx unit to finish the last character of ringbuffer
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// USART FUNCTIONS
+// Producer side; hands newly queued TX data to the DRE interrupt
+static inline void usart_tx_start(usart_port* port) {
+	USART_STAT_MAX(port, tx_high_water, rbuffer_count(port->tx));
+	port->tx_started = true;
+	port->usart->CTRLA |= USART_DREIE_bm;			// Enable Tx interrupt
+}
 
-	_delay_ms(200); 								// Extra safety for Tx to finish!
+void usart_send_char(usart_port* port, char c) {
+	if (rbuffer_full(port->tx)) {
+		USART_STAT_ADD(port, tx_blocked, 1);
+		USART_WAIT_WHILE(rbuffer_full(port->tx));
+	}
+	rbuffer_insert(c, port->tx);
+	usart_tx_start(port);
+}
 
-	USART1.CTRLB &= ~USART_RXEN_bm; 				// Disable Rx unit
-	USART1.CTRLB &= ~USART_TXEN_bm; 				// Disable Rx unit
+// Zero-copy send: write up to the returned number of bytes at *data, then
+// hand them to the transmitter with usart_tx_commit
+size_t usart_tx_reserve(usart_port* port, char** data) {
+	return rbuffer_reserve(port->tx, data);
+}
 
-	USART1.CTRLA &= ~USART_RXCIE_bm;				// Disable Rx interrupt
-	USART1.CTRLA &= ~USART_DREIE_bm;				// Disable Tx interrupt
+void usart_tx_commit(usart_port* port, size_t len) {
+	if (len) {
+		rbuffer_publish(port->tx, len);
+		usart_tx_start(port);
+	}
 }
-#endif
 
-// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-// USART2 FUNCTIONS
-#ifdef USART2_ENABLE
-void usart2_send_char(char c) {
-	while(rbuffer_full(&rb_tx2));
-	rbuffer_insert(c, &rb_tx2);
-	USART2.CTRLA |= USART_DREIE_bm;					// Enable Tx interrupt
+// Non-blocking; accepts the character only if there is room for it
+uint8_t usart_try_send(usart_port* port, char c) {
+	if (rbuffer_full(port->tx)) {
+		usart_arm_tx_hook(port);
+		return 0;
+	}
+	rbuffer_insert(c, port->tx);
+	usart_tx_start(port);
+	return 1;
 }
 
-int usart2_print_char(char c, FILE *stream) { 
-    usart2_send_char(c);							
+static int usart_print_char(char c, FILE *stream) { 
+	usart_port* port = fdev_get_udata(stream);
+	if (port->stream_mode & USART_STREAM_DROP) {
+		usart_try_send(port, c);					// Drop what does not fit
+	}
+	else {
+		usart_send_char(port, c);
+	}
     return 0; 
 }
 
-FILE USART2_stream = FDEV_SETUP_STREAM(usart2_print_char, NULL, _FDEV_SETUP_WRITE);
+void usart_set_stream_mode(usart_port* port, uint8_t mode) {
+	port->stream_mode = mode;
+}
+
+void usart_init(usart_port* port, usart_config_t config) {
+	USART_t* usart = port->usart;
 
-void usart2_init(uint16_t baud_rate) {
-	rbuffer_init(&rb_rx2);							// Init RX2 buffer
-	rbuffer_init(&rb_tx2);							// Init TX2 buffer
+	usart_rx_reset(port);							// Init RX buffer
+	rbuffer_init(port->tx);							// Init TX buffer
+	port->tx_started = false;
+	port->tx_data8 = false;
+	port->closing = false;
+	fdev_set_udata(port->stream, port);				// Route stream to this port
 	
-	usart2_port_init();								// Defined in uart_settings.h
+	port->port_init();								// Defined in uart_settings.h
 
-    USART2.BAUD = baud_rate; 						// Set BAUD rate
-	USART2.CTRLB |= USART_RXEN_bm | USART_TXEN_bm; 	// Enable Rx & Enable Tx 
-	USART2.CTRLA |= USART_RXCIE_bm ; 				// Enable Rx interrupt 
+    usart->BAUD = config.baud; 						// Set BAUD rate
+	usart->CTRLC = config.format;					// Frame format
+	usart->CTRLB = (usart->CTRLB & ~(USART_RXMODE_gm | USART_SFDEN_bm | USART_MPCM_bm)) | config.rxmode;	// Normal or CLK2X
+	if (config.options & USART_OPTION_WAKE) {
+		usart->CTRLB |= USART_SFDEN_bm;				// Start-of-frame detection; RXC wakes from STANDBY
+	}
+	if (port->rx_filter) {
+		usart->CTRLB |= USART_MPCM_bm;				// Data frames dropped until our address
+	}
+	usart->CTRLA &= ~USART_RS485_gm;
+	if (config.options & USART_OPTION_RS485) {
+		port->xdir_port->DIRSET = port->xdir_pin;
+		usart->CTRLA |= USART_RS485_EXT_gc;			// XDIR high while transmitting
+	}
+	USART_TXDATAH_WRITE(usart, 0);					// Ninth bit of data frames
+	usart->CTRLB |= USART_RXEN_bm | USART_TXEN_bm; 	// Enable Rx & Enable Tx 
+	usart->CTRLA |= USART_RXCIE_bm ; 				// Enable Rx interrupt 
 }
 
-void usart2_send_string(char* str, uint8_t len) {
-	for (size_t i=0; i<len; i++) {
-		usart2_send_char(str[i]);
+size_t usart_write(usart_port* port, const void* data, size_t len) {
+	const char* src = data;
+	size_t left = len;
+	bool blocked = false;
+	while (left) {									// Blocks only while the ring is full
+		rbuffer_index_t n = rbuffer_write(port->tx, src, left);
+		if (n) {
+			src += n;
+			left -= n;
+			usart_tx_start(port);
+		}
+		else {
+			if (!blocked) {
+				blocked = true;
+				USART_STAT_ADD(port, tx_blocked, 1);
+			}
+			USART_WAIT_WHILE(rbuffer_full(port->tx));
+		}
 	}
+	return len;
 }
 
-uint16_t usart2_read_char(void) {
-	if (!rbuffer_empty(&rb_rx2)) {
-		return (((usart2_error & USART_RX_ERROR_MASK) << 8) | (uint16_t)rbuffer_remove(&rb_rx2));
+// Non-blocking; copies what fits in one pass and returns the number of bytes accepted
+size_t usart_try_write(usart_port* port, const void* data, size_t len) {
+	rbuffer_index_t n = rbuffer_write(port->tx, data, len);
+	if (n) {
+		usart_tx_start(port);
 	}
-	else {
-		return (((usart2_error & USART_RX_ERROR_MASK) << 8) | USART_NO_DATA);		// Empty ringbuffer
+	if (n < len) {
+		usart_arm_tx_hook(port);
 	}
+	return n;
 }
 
-// Disable unit Tx and Rx before its interrupts!
-void usart2_close(void) {
-	while(!rbuffer_empty(&rb_tx2)); 				// Wait for Tx to finish all character in ring buffer
-	while(!(USART2.STATUS & USART_DREIF_bm)); 		// Wait for Tx unit to finish the last character of ringbuffer
+void usart_send_string(usart_port* port, char* str, uint8_t len) {
+	usart_write(port, str, len);
+}
 
-	_delay_ms(200); 								// Extra safety for Tx to finish!
+static uint16_t usart_rx_get(usart_port* port) {
+	ringbuffer* rx = port->rx;
+	uint16_t flags = 0;
+
+	if (rbuffer_empty(rx)) {
+		if (port->rx_stopped) {
+			flags = USART_BUFFER_OVERFLOW;			// Receiver stopped on overflow
+		}
+		else if (port->rx_lost) {
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+				if (port->rx_lost && rbuffer_empty(rx)) {
+					port->rx_lost = false;			// Reported here; no byte followed the loss
+					flags = USART_BUFFER_OVERFLOW;
+				}
+			}
+		}
+		return (flags | USART_NO_DATA);				// Empty ringbuffer
+	}
+	if (port->rx_dropped) {
+		port->rx_dropped = false;					// Atomic in USART_RX_DROP_OLDEST, the only setter
+		flags |= USART_BUFFER_OVERFLOW;
+	}
+	uint8_t code = usart_rx_flag(port, rx->out);
+	if (code) {
+		if (code & USART_RX_PARITY) {
+			flags |= USART_PARITY_ERROR;
+		}
+		if (code & USART_RX_FRAME) {
+			flags |= USART_FRAME_ERROR;
+		}
+		if (code & USART_RX_OVERFLOW) {
+			flags |= USART_BUFFER_OVERFLOW;			// Data was lost before this byte
+		}
+		usart_rx_clear_flag(port);
+	}
+	return (flags | (uint8_t)rbuffer_remove(rx));
+}
 
-	USART2.CTRLB &= ~USART_RXEN_bm; 				// Disable Rx unit
-	USART2.CTRLB &= ~USART_TXEN_bm; 				// Disable Rx unit
+uint16_t usart_read_char(usart_port* port) {
+	if (port->rx_policy == USART_RX_DROP_OLDEST) {	// ISR may move `out` too
+		uint16_t c;
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			c = usart_rx_get(port);
+		}
+		return c;
+	}
+	return usart_rx_get(port);
+}
 
-	USART2.CTRLA &= ~USART_RXCIE_bm;				// Disable Rx interrupt
-	USART2.CTRLA &= ~USART_DREIE_bm;				// Disable Tx interrupt
+// Flagged bytes end a span; they are read with usart_read_char
+size_t usart_rx_peek(usart_port* port, const char** data) {
+	return usart_rx_unflagged(port, rbuffer_peek(port->rx, data));
 }
-#endif
 
-// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-// USART3 FUNCTIONS
-#ifdef USART3_ENABLE
-void usart3_send_char(char c) {
-	while(rbuffer_full(&rb_tx3));
-	rbuffer_insert(c, &rb_tx3);
-	USART3.CTRLA |= USART_DREIE_bm;					// Enable Tx interrupt
+static void usart_rx_skip(usart_port* port, size_t len) {
+	rbuffer_index_t count = rbuffer_count(port->rx);
+	if (len > count) {
+		len = count;
+	}
+	rbuffer_commit(port->rx, usart_rx_unflagged(port, len));
 }
 
-int usart3_print_char(char c, FILE *stream) { 
-    usart3_send_char(c);							
-    return 0; 
+void usart_rx_commit(usart_port* port, size_t len) {
+	if (port->rx_policy == USART_RX_DROP_OLDEST) {	// ISR may move `out` too
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			usart_rx_skip(port, len);
+		}
+		return;
+	}
+	usart_rx_skip(port, len);
 }
 
-FILE USART3_stream = FDEV_SETUP_STREAM(usart3_print_char, NULL, _FDEV_SETUP_WRITE);
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// MULTIDROP
+// Multi-processor communication mode for USART_FORMAT_9N1 buses: frames with
+// the ninth bit set carry a node address. With MPCM set the unit drops data
+// frames itself, so other nodes' traffic raises no RXC interrupt; only
+// address frames reach the handler. One matching address or broadcast
+// clears MPCM until the next address frame, which selects another node.
+void usart_set_address(usart_port* port, uint8_t address, uint8_t broadcast) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		port->rx_address = address;
+		port->rx_broadcast = broadcast;				// Same as address for none
+		port->rx_filter = true;
+		port->usart->CTRLB |= USART_MPCM_bm;
+	}
+}
 
-void usart3_init(uint16_t baud_rate) {
-	rbuffer_init(&rb_rx3);							// Init RX3 buffer
-	rbuffer_init(&rb_tx3);							// Init TX3 buffer
-	
-	usart3_port_init();								// Defined in uart_settings.h
+void usart_clear_address(usart_port* port) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		port->rx_filter = false;
+		port->usart->CTRLB &= ~USART_MPCM_bm;
+	}
+}
 
-    USART3.BAUD = baud_rate; 						// Set BAUD rate
-	USART3.CTRLB |= USART_RXEN_bm | USART_TXEN_bm; 	// Enable Rx & Enable Tx 
-	USART3.CTRLA |= USART_RXCIE_bm ; 				// Enable Rx interrupt 
+// The ninth bit is set through TXDATAH, which the DRE handler leaves at zero,
+// so the address waits until the data register has taken the last queued
+// byte; the DRE interrupt that finds the ring empty ends the wait. TXDATAH
+// and TXDATAL are ignored while DREIF is clear, which it may be again right
+// after the address, so the next writer of a data byte clears the bit.
+void usart_send_address(usart_port* port, uint8_t address) {
+	USART_t* usart = port->usart;
+
+	usart_tx_start(port);
+	USART_WAIT_WHILE(usart->CTRLA & USART_DREIE_bm);
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		USART_POLL_WHILE(!(usart->STATUS & USART_DREIF_bm));	// A previous address, at most
+		USART_STATUS_WRITE(usart, USART_TXCIF_bm);	// TXCIF now tracks this character
+		USART_TXDATAH_WRITE(usart, USART_DATA8_bm);	// High byte first in USART_FORMAT_9N1
+		USART_TXDATAL_WRITE(usart, address);
+		port->tx_data8 = true;
+		USART_STAT_ADD(port, tx_bytes, 1);
+	}
 }
 
-void usart3_send_string(char* str, uint8_t len) {
-	for (size_t i=0; i<len; i++) {
-		usart3_send_char(str[i]);
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// STREAM INPUT
+// True when the stream has something to read: any byte, or with
+// USART_STREAM_LINE the rest of a line ending in '\n'. A full ring or a stopped
+// receiver releases what is there, since no '\n' could arrive. Indices are
+// kept against the free running RX `out`, so bytes read around the stream or
+// dropped by USART_RX_DROP_OLDEST only restart the scan.
+static bool usart_stream_ready(usart_port* port) {
+	ringbuffer* rx = port->rx;
+	rbuffer_index_t out = rbuffer_get(&rx->out);
+	rbuffer_index_t count = (rbuffer_index_t)(rbuffer_get(&rx->in) - out);
+
+	if (!(port->stream_mode & USART_STREAM_LINE)) {
+		return count || port->rx_stopped;
+	}
+	rbuffer_index_t left = port->stream_eol - out;
+	if (left && left <= count) {
+		return true;								// Rest of a released line
+	}
+	rbuffer_index_t scanned = port->stream_scan - out;
+	if (scanned > count) {
+		scanned = 0;
 	}
+	rbuffer_barrier();								// Index check before data
+	for (; scanned < count; scanned++) {
+		if (rx->buffer[(rbuffer_index_t)(out + scanned) & rx->mask] == '\n') {
+			port->stream_eol = port->stream_scan = out + scanned + 1;
+			return true;
+		}
+	}
+	port->stream_scan = out + scanned;
+	if (count > rx->mask || port->rx_stopped) {
+		port->stream_eol = out + count;
+		return true;
+	}
+	return false;
 }
 
-uint16_t usart3_read_char(void) {
-	if (!rbuffer_empty(&rb_rx3)) {
-		return (((usart3_error & USART_RX_ERROR_MASK) << 8) | (uint16_t)rbuffer_remove(&rb_rx3));
+static int usart_get_char(FILE *stream) {
+	usart_port* port = fdev_get_udata(stream);
+	if (port->stream_mode & USART_STREAM_NONBLOCK) {
+		if (!usart_stream_ready(port)) {
+			return _FDEV_EOF;
+		}
 	}
 	else {
-		return (((usart3_error & USART_RX_ERROR_MASK) << 8) | USART_NO_DATA);		// Empty ringbuffer
+		USART_WAIT_WHILE(!usart_stream_ready(port));
+	}
+	uint16_t c = usart_read_char(port);
+	if (c & (USART_NO_DATA | USART_PARITY_ERROR | USART_FRAME_ERROR | USART_BUFFER_OVERFLOW)) {
+		return _FDEV_ERR;							// Flagged byte, or stopped and empty
 	}
+	return (uint8_t)c;
 }
 
-// Disable unit Tx and Rx before its interrupts!
-void usart3_close(void) {
-	while(!rbuffer_empty(&rb_tx3)); 				// Wait for Tx to finish all character in ring buffer
-	while(!(USART3.STATUS & USART_DREIF_bm)); 		// Wait for Tx unit to finish the last character of ringbuffer
+#ifdef USART_FRAME_QUEUE
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// FRAME ASSEMBLER
+// Frames stay in the RX ring. The RXC ISR counts the bytes it stores and, at
+// each delimiter or fixed length, queues the ring's `in` index as the frame
+// end; the reader takes frames from `out` to the oldest queued end. A frame
+// completed while the queue is full extends the newest queued frame, and
+// reading that one reports USART_BUFFER_OVERFLOW. So does a frame the ISR
+// closes early because a byte of it was dropped, which keeps a frame longer
+// than the ring from filling it for good. Reading bytes some other way
+// shortens the oldest frame; ends that fall behind `out` are skipped.
+// In gap mode every byte restarts the port's gap timer from zero; when it
+// reaches the gap, its interrupt closes the frame and stops it again. A byte
+// that finds the gap already passed, its interrupt pending behind RXC or held
+// off, closes the frame before itself and clears the flag.
+#define USART_FRAME_SLOT(index)   ((index) & (USART_FRAME_QUEUE - 1))
+
+// ISR side; queues the frame that ends at index end, marked as overflowed
+// when truncated
+static void usart_frame_close(usart_port* port, rbuffer_index_t end, bool truncated) {
+	uint16_t now = USART_TIMESTAMP();
+	port->frame_count = 0;
+	uint8_t in = port->frame_in;
+	if ((uint8_t)(in - port->frame_out) < USART_FRAME_QUEUE) {
+		port->frame_end[USART_FRAME_SLOT(in)] = end;
+		port->frame_time[USART_FRAME_SLOT(in)] = now;
+		if (truncated) {
+			port->frame_merged |= (uint8_t)(1 << USART_FRAME_SLOT(in));
+		}
+		rbuffer_barrier();							// End before count
+		port->frame_in = in + 1;
+	}
+	else {
+		uint8_t last = USART_FRAME_SLOT(in - 1);	// Never the slot being read
+		port->frame_end[last] = end;
+		port->frame_time[last] = now;
+		port->frame_merged |= (uint8_t)(1 << last);
+		USART_STAT_ADD(port, frames_merged, 1);
+	}
+	USART_STAT_ADD(port, frames, 1);
+	if (port->frame_hook) {
+		port->frame_hook(port);						// Runs in interrupt context
+	}
+}
 
-	_delay_ms(200); 								// Extra safety for Tx to finish!
+// ISR side; counts one stored byte
+static inline void usart_frame_byte(usart_port* port, ringbuffer* rx, char data) {
+	port->frame_count++;
+	switch (port->frame_mode) {
+	case USART_FRAME_DELIMITER:
+		if ((uint8_t)data == port->frame_value) {
+			usart_frame_close(port, rx->in, false);
+		}
+		break;
+	case USART_FRAME_LENGTH:
+		if (port->frame_count >= port->frame_value) {
+			usart_frame_close(port, rx->in, false);
+		}
+		break;
+	default: {
+		TCB_t* timer = port->gap_timer;
+		timer->CTRLA = 0;
+		if ((timer->INTFLAGS & TCB_CAPT_bm) && port->frame_count > 1) {
+			usart_frame_close(port, rx->in - 1, false);	// The gap passed before this byte
+			port->frame_count = 1;
+		}
+		timer->CNT = 0;
+		USART_INTFLAGS_WRITE(timer, TCB_CAPT_bm);
+		timer->CTRLA = port->gap_ctrla;
+		break;
+	}
+	}
+}
 
-	USART3.CTRLB &= ~USART_RXEN_bm; 				// Disable Rx unit
-	USART3.CTRLB &= ~USART_TXEN_bm; 				// Disable Rx unit
+// Gap timer interrupt; the line stayed silent for the whole gap
+static inline void usart_gap_handler(usart_port* port) {
+	port->gap_timer->CTRLA = 0;
+	USART_INTFLAGS_WRITE(port->gap_timer, TCB_CAPT_bm);
+	if (port->frame_count) {
+		usart_frame_close(port, port->rx->in, false);
+	}
+}
 
-	USART3.CTRLA &= ~USART_RXCIE_bm;				// Disable Rx interrupt
-	USART3.CTRLA &= ~USART_DREIE_bm;				// Disable Tx interrupt
+// Gap of `bits` bit times at the current BAUD and RXMODE; the timer runs at
+// CLK_PER / 2 when the gap does not fit 16 bits at CLK_PER
+static void usart_gap_setup(usart_port* port, uint16_t bits) {
+	USART_t* usart = port->usart;
+	TCB_t* timer = port->gap_timer;
+	uint8_t s = ((usart->CTRLB & USART_RXMODE_gm) == USART_RXMODE_CLK2X_gc) ? 8 : 16;
+	uint32_t cycles = ((uint32_t)bits * s * usart->BAUD) / 64;	// F_CPU / baud = S * BAUD / 64
+	uint8_t clksel = TCB_CLKSEL_CLKDIV1_gc;
+
+	if (cycles > 0xFFFF) {
+		cycles /= 2;
+		clksel = TCB_CLKSEL_CLKDIV2_gc;
+	}
+	timer->CTRLA = 0;
+	timer->CTRLB = TCB_CNTMODE_INT_gc;
+	timer->CCMP = (cycles > 0xFFFF) ? 0xFFFF : (cycles ? cycles : 1);
+	timer->CNT = 0;
+	USART_INTFLAGS_WRITE(timer, TCB_CAPT_bm);
+	timer->INTCTRL = TCB_CAPT_bm;
+	port->gap_ctrla = clksel | TCB_ENABLE_bm;
 }
-#endif
 
-// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-// USART4 FUNCTIONS
-#ifdef USART4_ENABLE
-void usart4_send_char(char c) {
-	while(rbuffer_full(&rb_tx4));
-	rbuffer_insert(c, &rb_tx4);
-	USART4.CTRLA |= USART_DREIE_bm;					// Enable Tx interrupt
+// Reader side; drops the oldest queued frame and tells whether it was merged
+static bool usart_frame_pop(usart_port* port) {
+	uint8_t out = port->frame_out;
+	uint8_t bm = (uint8_t)(1 << USART_FRAME_SLOT(out));
+	bool merged = false;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (port->frame_merged & bm) {
+			port->frame_merged &= (uint8_t)~bm;
+			merged = true;
+		}
+	}
+	port->frame_out = out + 1;
+	return merged;
 }
 
-int usart4_print_char(char c, FILE *stream) { 
-    usart4_send_char(c);							
-    return 0; 
+// Reader side; bytes in the oldest queued frame, 0 if there is none
+static rbuffer_index_t usart_frame_length(usart_port* port) {
+	ringbuffer* rx = port->rx;
+	while (port->frame_out != port->frame_in) {
+		rbuffer_barrier();							// Count before end
+		rbuffer_index_t end = rbuffer_get(&port->frame_end[USART_FRAME_SLOT(port->frame_out)]);
+		rbuffer_index_t len = (rbuffer_index_t)(end - rbuffer_get(&rx->out));
+		if (len && len <= rbuffer_count(rx)) {
+			return len;
+		}
+		usart_frame_pop(port);						// Already consumed
+	}
+	return 0;
 }
 
-FILE USART4_stream = FDEV_SETUP_STREAM(usart4_print_char, NULL, _FDEV_SETUP_WRITE);
+// Bytes already in the RX ring become part of the first frame. Gap mode takes
+// its timing from the current baud rate, so set it after usart_init, and is
+// refused (USART_FRAME_OFF) on a port without a gap timer.
+void usart_set_frame(usart_port* port, uint8_t mode, uint16_t value, usart_frame_hook hook) {
+	if (mode == USART_FRAME_LENGTH && (value == 0 || value > rbuffer_size(port->rx))) {
+		value = rbuffer_size(port->rx);
+	}
+	if (mode == USART_FRAME_GAP && !port->gap_timer) {
+		mode = USART_FRAME_OFF;
+	}
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (port->gap_timer) {
+			port->gap_timer->CTRLA = 0;
+			port->gap_timer->INTCTRL = 0;
+		}
+		if (mode == USART_FRAME_GAP) {
+			usart_gap_setup(port, value);
+		}
+		port->frame_mode = mode;
+		port->frame_value = value;
+		port->frame_hook = hook;
+		port->frame_count = rbuffer_count(port->rx);
+		port->frame_out = port->frame_in;
+		port->frame_merged = 0;
+	}
+}
 
-void usart4_init(uint16_t baud_rate) {
-	rbuffer_init(&rb_rx4);							// Init RX4 buffer
-	rbuffer_init(&rb_tx4);							// Init TX4 buffer
-	
-	usart4_port_init();								// Defined in uart_settings.h
+uint8_t usart_frames(usart_port* port) {
+	return (uint8_t)(port->frame_in - port->frame_out);
+}
 
-    USART4.BAUD = baud_rate; 						// Set BAUD rate
-	USART4.CTRLB |= USART_RXEN_bm | USART_TXEN_bm; 	// Enable Rx & Enable Tx 
-	USART4.CTRLA |= USART_RXCIE_bm ; 				// Enable Rx interrupt 
+// Valid while usart_frames is not 0
+uint16_t usart_frame_time(usart_port* port) {
+	usart_frame_length(port);						// Skips consumed frames
+	uint16_t time;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		time = port->frame_time[USART_FRAME_SLOT(port->frame_out)];
+	}
+	return time;
 }
 
-void usart4_send_string(char* str, uint8_t len) {
-	for (size_t i=0; i<len; i++) {
-		usart4_send_char(str[i]);
+// Copies the oldest complete frame to buf and removes it from the RX ring.
+// Returns its length, which may exceed size; the rest is discarded. errors
+// collects the USART_*_ERROR flags of its bytes and may be NULL. 0 if none.
+size_t usart_read_frame(usart_port* port, void* buf, size_t size, uint16_t* errors) {
+	char* dst = buf;
+	rbuffer_index_t len = usart_frame_length(port);
+	rbuffer_index_t done = 0;
+	uint16_t flags = 0;
+
+	while (done < len) {
+		const char* data;
+		size_t n = 0;
+		if (port->rx_policy != USART_RX_DROP_OLDEST) {	// Else the ISR may move `out`
+			n = usart_rx_peek(port, &data);
+		}
+		if (n) {
+			if (n > (size_t)(len - done)) {
+				n = len - done;
+			}
+			if (done < size) {
+				memcpy(dst + done, data, (size - done < n) ? size - done : n);
+			}
+			usart_rx_commit(port, n);
+			done += n;
+		}
+		else {
+			uint16_t c = usart_read_char(port);		// Flagged byte, or bytewise
+			if (c & USART_NO_DATA) {
+				flags |= USART_BUFFER_OVERFLOW;		// Dropped under USART_RX_DROP_OLDEST
+				break;
+			}
+			if (done < size) {
+				dst[done] = (char)c;
+			}
+			flags |= c & (USART_BUFFER_OVERFLOW | USART_FRAME_ERROR | USART_PARITY_ERROR);
+			done++;
+		}
+	}
+	if (len && usart_frame_pop(port)) {
+		flags |= USART_BUFFER_OVERFLOW;
+	}
+	if (errors) {
+		*errors = flags;
 	}
+	return len;
 }
+#endif
+
+// Disable unit Tx and Rx before its interrupts! Runs with interrupts off.
+static void usart_shutdown(usart_port* port) {
+	USART_t* usart = port->usart;
+
+	usart->CTRLB &= ~USART_RXEN_bm; 				// Disable Rx unit
+	usart->CTRLB &= ~USART_TXEN_bm; 				// Disable Tx unit
 
-uint16_t usart4_read_char(void) {
-	if (!rbuffer_empty(&rb_rx4)) {
-		return (((usart4_error & USART_RX_ERROR_MASK) << 8) | (uint16_t)rbuffer_remove(&rb_rx4));
+	usart->CTRLA &= ~USART_RXCIE_bm;				// Disable Rx interrupt
+	usart->CTRLA &= ~USART_DREIE_bm;				// Disable Tx interrupt
+	usart->CTRLA &= ~USART_TXCIE_bm;				// Disable Tx complete interrupt
+#ifdef USART_FRAME_QUEUE
+	if (port->gap_timer) {
+		port->gap_timer->CTRLA = 0;					// Stop gap timer
 	}
-	else {
-		return (((usart4_error & USART_RX_ERROR_MASK) << 8) | USART_NO_DATA);		// Empty ringbuffer
+#endif
+
+	port->closing = false;
+	if (port->close_hook) {
+		port->close_hook(port);
 	}
 }
 
-// Disable unit Tx and Rx before its interrupts!
-void usart4_close(void) {
-	while(!rbuffer_empty(&rb_tx4)); 				// Wait for Tx to finish all character in ring buffer
-	while(!(USART4.STATUS & USART_DREIF_bm)); 		// Wait for Tx unit to finish the last character of ringbuffer
+// Returns at once; the TXC interrupt shuts the unit down after the stop bit of
+// the last queued character and then calls hook, which may be NULL
+void usart_close_async(usart_port* port, usart_close_hook hook) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		port->close_hook = hook;
+		port->closing = true;
+		if (!port->tx_started || (rbuffer_empty(port->tx) && (port->usart->STATUS & USART_TXCIF_bm))) {
+			usart_shutdown(port);					// Nothing sent, or all of it is out
+		}
+		else {
+			port->usart->CTRLA |= USART_TXCIE_bm;	// Enable Tx complete interrupt
+		}
+	}
+}
 
-	_delay_ms(200); 								// Extra safety for Tx to finish!
+bool usart_closing(usart_port* port) {
+	return port->closing;
+}
 
-	USART4.CTRLB &= ~USART_RXEN_bm; 				// Disable Rx unit
-	USART4.CTRLB &= ~USART_TXEN_bm; 				// Disable Rx unit
+// With interrupts off the DRE and TXC interrupts cannot run, so the rest of
+// the TX ring is handed to the unit by polling DREIF and the last stop bit by
+// polling TXCIF; usart_close_async then shuts down at once.
+static void usart_tx_poll(usart_port* port) {
+	USART_t* usart = port->usart;
+	ringbuffer* tx = port->tx;
+
+	while (!rbuffer_empty(tx)) {
+		USART_POLL_WHILE(!(usart->STATUS & USART_DREIF_bm));
+		if (port->tx_data8) {
+			USART_TXDATAH_WRITE(usart, 0);			// Data frame after an address
+			port->tx_data8 = false;
+		}
+		USART_STATUS_WRITE(usart, USART_TXCIF_bm);	// TXCIF now tracks this character
+		USART_TXDATAL_WRITE(usart, rbuffer_remove(tx));
+		USART_STAT_ADD(port, tx_bytes, 1);
+	}
+	if (port->tx_started) {
+		USART_POLL_WHILE(!(usart->STATUS & USART_TXCIF_bm));
+	}
+}
 
-	USART4.CTRLA &= ~USART_RXCIE_bm;				// Disable Rx interrupt
-	USART4.CTRLA &= ~USART_DREIE_bm;				// Disable Tx interrupt
+void usart_close(usart_port* port) {
+	if (!(SREG & CPU_I_bm)) {
+		usart_tx_poll(port);
+	}
+	usart_close_async(port, NULL);
+	USART_WAIT_WHILE(port->closing);				// Wait for the last stop bit
+}
+
+#ifdef USART_TIMER
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// TIMER
+// USART_TIMER counts CPU cycles while a blocking helper runs. Each full count
+// sets CAPT, so the elapsed time is wraps * 65536 + CNT. Helpers that sleep
+// enable the CAPT interrupt so a wrap wakes them to check their timeout.
+static volatile uint16_t usart_timer_wraps;
+
+static void usart_timer_start(void) {
+	USART_TIMER.CTRLA = 0;
+	USART_TIMER.CTRLB = TCB_CNTMODE_INT_gc;			// Periodic, interrupt left disabled
+	USART_TIMER.CCMP = 0xFFFF;
+	USART_TIMER.CNT = 0;
+	USART_INTFLAGS_WRITE(&USART_TIMER, TCB_CAPT_bm);
+	USART_TIMER.CTRLA = TCB_CLKSEL_CLKDIV1_gc | TCB_ENABLE_bm;
+	usart_timer_wraps = 0;
+}
+
+static void usart_timer_stop(void) {
+	USART_TIMER.CTRLA = 0;
+	USART_TIMER.INTCTRL = 0;
+}
+
+ISR(USART_TIMER_vect) {
+	USART_INTFLAGS_WRITE(&USART_TIMER, TCB_CAPT_bm);
+	usart_timer_wraps++;
+}
+
+// True once ms milliseconds have passed since usart_timer_start; never for 0.
+// Must be polled at least once per 65536 cycles to see every wrap, and with
+// interrupts off while the CAPT interrupt is enabled.
+static bool usart_timer_expired(uint16_t ms) {
+	if (USART_TIMER.INTFLAGS & TCB_CAPT_bm) {
+		USART_INTFLAGS_WRITE(&USART_TIMER, TCB_CAPT_bm);
+		usart_timer_wraps++;
+	}
+	if (!ms) {
+		return false;
+	}
+	uint32_t elapsed = ((uint32_t)usart_timer_wraps << 16) | USART_TIMER.CNT;
+	return elapsed >= (uint32_t)ms * (F_CPU / 1000);
 }
-#endif
 
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-// USART5 FUNCTIONS
+// WAIT FOR DATA
+// Received data, or a complete frame while the frame assembler is on
+static inline bool usart_rx_pending(usart_port* port) {
+#ifdef USART_FRAME_QUEUE
+	if (port->frame_mode) {
+		return port->frame_in != port->frame_out;
+	}
+#endif
+	return !rbuffer_empty(port->rx);
+}
+
+static uint8_t usart_rx_ready(uint8_t ports) {
+	uint8_t ready = 0;
+#ifdef USART0_ENABLE
+	if ((ports & USART_WAIT_PORT(0)) && usart_rx_pending(&USART0_port)) {
+		ready |= USART_WAIT_PORT(0);
+	}
+#endif
+#ifdef USART1_ENABLE
+	if ((ports & USART_WAIT_PORT(1)) && usart_rx_pending(&USART1_port)) {
+		ready |= USART_WAIT_PORT(1);
+	}
+#endif
+#ifdef USART2_ENABLE
+	if ((ports & USART_WAIT_PORT(2)) && usart_rx_pending(&USART2_port)) {
+		ready |= USART_WAIT_PORT(2);
+	}
+#endif
+#ifdef USART3_ENABLE
+	if ((ports & USART_WAIT_PORT(3)) && usart_rx_pending(&USART3_port)) {
+		ready |= USART_WAIT_PORT(3);
+	}
+#endif
+#ifdef USART4_ENABLE
+	if ((ports & USART_WAIT_PORT(4)) && usart_rx_pending(&USART4_port)) {
+		ready |= USART_WAIT_PORT(4);
+	}
+#endif
 #ifdef USART5_ENABLE
-void usart5_send_char(char c) {
-	while(rbuffer_full(&rb_tx5));
-	rbuffer_insert(c, &rb_tx5);
-	USART5.CTRLA |= USART_DREIE_bm;					// Enable Tx interrupt
+	if ((ports & USART_WAIT_PORT(5)) && usart_rx_pending(&USART5_port)) {
+		ready |= USART_WAIT_PORT(5);
+	}
+#endif
+	return ready;
 }
 
-int usart5_print_char(char c, FILE *stream) { 
-    usart5_send_char(c);							
-    return 0; 
+// Sleeps until one of the ports has received data, or a frame in frame mode. Returns the USART_WAIT_PORT
+// bits of the ports with data, or 0 on timeout. A timeout of 0 waits forever
+// and then leaves the timer interrupt off, so only received data wakes the CPU.
+uint8_t usart_wait_any(uint8_t ports, uint16_t timeout_ms) {
+	uint8_t ready;
+
+	usart_timer_start();
+	if (timeout_ms) {
+		USART_TIMER.INTCTRL = TCB_CAPT_bm;
+	}
+	USART_WAIT_WHILE(!(ready = usart_rx_ready(ports)) && !usart_timer_expired(timeout_ms));
+	usart_timer_stop();
+	return ready;
 }
 
-FILE USART5_stream = FDEV_SETUP_STREAM(usart5_print_char, NULL, _FDEV_SETUP_WRITE);
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// AUTO-BAUD
+// Hardware: generic auto-baud (RXMODE GENAUTO) measures a break followed by a
+// 0x55 sync field and writes the result to BAUD itself.
+// Software: 0x55 has an edge after every bit, and the rising one that ends
+// its start bit is 8 bit times before the one that starts the stop bit.
+// Timed in CPU cycles that is 8 * F_CPU / baud, and the normal mode BAUD value
+// 4 * F_CPU / baud is half of it. The line is watched for a start bit with
+// interrupts on; they are off only while the edges of that character are
+// timed by polling the Rx pin. The resolution is one polling loop of a few
+// cycles, so the sync character should span a few hundred cycles or more.
+
+// Waits while the Rx pin reads level; false on timeout
+static inline bool usart_pin_wait(PORT_t* pin, uint8_t bm, uint8_t level, uint16_t ms) {
+	while ((USART_PIN_READ(pin) & bm) == level) {
+		if (usart_timer_expired(ms)) {
+			return false;
+		}
+	}
+	return true;
+}
 
-void usart5_init(uint16_t baud_rate) {
-	rbuffer_init(&rb_rx5);							// Init RX5 buffer
-	rbuffer_init(&rb_tx5);							// Init TX5 buffer
-	
-	usart5_port_init();								// Defined in uart_settings.h
+// The same within a character; false once more than limit cycles passed
+// since from, or the timer wrapped to `last`
+static inline bool usart_edge_wait(PORT_t* pin, uint8_t bm, uint8_t level,
+		uint16_t from, uint16_t limit, uint16_t last) {
+	while ((USART_PIN_READ(pin) & bm) == level) {
+		if ((uint16_t)(USART_TIMER.CNT - from) > limit) {
+			return false;
+		}
+		if (USART_TIMER.INTFLAGS & TCB_CAPT_bm) {
+			usart_timer_expired(0);					// Counts the wrap
+			if (usart_timer_wraps == last) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
 
-    USART5.BAUD = baud_rate; 						// Set BAUD rate
-	USART5.CTRLB |= USART_RXEN_bm | USART_TXEN_bm; 	// Enable Rx & Enable Tx 
-	USART5.CTRLA |= USART_RXCIE_bm ; 				// Enable Rx interrupt 
+// BAUD register value from the sync field, 0 on timeout
+static uint16_t usart_autobaud_hw(USART_t* usart, uint16_t ms) {
+	usart->CTRLB = (usart->CTRLB & ~USART_RXMODE_gm) | USART_RXMODE_GENAUTO_gc;
+	do {
+		USART_STATUS_WRITE(usart, USART_BDF_bm | USART_ISFIF_bm);	// Clear old results
+		USART_STATUS_WRITE(usart, USART_WFB_bm);				// Next falling edge starts a break
+		while (!(usart->STATUS & (USART_BDF_bm | USART_ISFIF_bm))) {
+			if (usart_timer_expired(ms)) {
+				return 0;
+			}
+		}
+	} while (!(usart->STATUS & USART_BDF_bm));		// Sync field out of range; try again
+	USART_STATUS_WRITE(usart, USART_BDF_bm);
+	return usart->BAUD;
 }
 
-void usart5_send_string(char* str, uint8_t len) {
-	for (size_t i=0; i<len; i++) {
-		usart5_send_char(str[i]);
+// Runs with interrupts off from within a start bit that was seen at timer
+// count start. CPU cycles from the end of the start bit to the start of the
+// stop bit, or 0 as soon as the character cannot be 0x55: the start bit was
+// over already, the first data bit lasts over 16 start bits, or a later bit
+// is not about as long as the first. A low bit right after a long first one
+// is taken for the start bit of a 0x55 that follows, once. Interrupts are so
+// off for two characters at most, apart from a start bit longer than a
+// timer wrap.
+static uint16_t usart_sync_time(PORT_t* pin, uint8_t bm, uint16_t start) {
+	uint16_t last = usart_timer_wraps + 2;
+	uint16_t edge[9];								// Rising, then falling and rising four times
+	uint16_t limit = 0xFFFF;
+	uint16_t bit = 0;
+	bool again = false;
+
+	if (USART_PIN_READ(pin) & bm) {
+		return 0;									// Seen too late
 	}
+	for (uint8_t i = 0; i < 9; i++) {
+		uint16_t from = i ? edge[i - 1] : start;
+		if (!usart_edge_wait(pin, bm, (i & 1) ? bm : 0, from, limit, last)) {
+			return 0;
+		}
+		edge[i] = USART_TIMER.CNT;
+		uint16_t d = edge[i] - from;
+		if (i == 1) {
+			bit = d;
+			limit = bit + bit / 2;
+		} else if (i == 0 || (i == 2 && d < bit - bit / 2 && !again)) {
+			if (i) {								// Start bit of the next character
+				edge[0] = edge[2];
+				i = 0;
+				again = true;
+			}
+			limit = (d < 0x1000) ? d << 4 : 0xFFFF;	// Short if an interrupt delayed the start
+		} else if (d < bit - bit / 2) {
+			return 0;
+		}
+	}
+	return edge[8] - edge[0];
 }
 
-uint16_t usart5_read_char(void) {
-	if (!rbuffer_empty(&rb_rx5)) {
-		return (((usart5_error & USART_RX_ERROR_MASK) << 8) | (uint16_t)rbuffer_remove(&rb_rx5));
+// CPU cycles for 8 bit times of the sync character, 0 on timeout. A character
+// that cannot be timed is skipped and the next one measured.
+static uint16_t usart_autobaud_soft(usart_port* port, uint16_t ms) {
+	PORT_t* pin = port->rx_port;
+	uint8_t bm = port->rx_pin;
+
+	for (;;) {
+		uint16_t ticks = 0;
+		if (!usart_pin_wait(pin, bm, 0, ms) ||		// Line idle
+			!usart_pin_wait(pin, bm, bm, ms)) {		// Start bit
+			return 0;
+		}
+		uint16_t start = USART_TIMER.CNT;
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			ticks = usart_sync_time(pin, bm, start);
+		}
+		if (ticks) {
+			return ticks;
+		}
+	}
+}
+
+// Measures the rate of the next sync character, moves the port to it and
+// restarts reception with an empty RX ring. Returns the detected baud rate,
+// or 0 on timeout with the old settings restored. A timeout of 0 waits forever.
+uint32_t usart_autobaud(usart_port* port, uint8_t method, uint16_t timeout_ms) {
+	USART_t* usart = port->usart;
+	uint16_t old_baud = usart->BAUD;
+	uint8_t old_rxmode = usart->CTRLB & USART_RXMODE_gm;
+	uint16_t baud;
+	uint8_t rxmode = USART_RXMODE_NORMAL_gc;
+	uint8_t s = 16;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		usart->CTRLA &= ~USART_RXCIE_bm;			// The ring restarts at the new rate
+	}
+	usart_timer_start();
+	if (method == USART_AUTOBAUD_HW) {
+		baud = usart_autobaud_hw(usart, timeout_ms);
 	}
 	else {
-		return (((usart5_error & USART_RX_ERROR_MASK) << 8) | USART_NO_DATA);		// Empty ringbuffer
+		uint16_t ticks = usart_autobaud_soft(port, timeout_ms);
+		baud = (ticks + 1) / 2;
+		if (baud < 64) {							// Too fast for normal mode
+			baud = ticks;
+			rxmode = USART_RXMODE_CLK2X_gc;
+			s = 8;
+		}
+	}
+	usart_timer_stop();
+
+	bool found = (baud >= 64);						// Else timeout or out of range
+	if (!found) {
+		baud = old_baud;
+		rxmode = old_rxmode;
+	}
+	usart->CTRLB &= ~USART_RXEN_bm;					// Flushes what arrived at the old rate
+	usart->BAUD = baud;
+	usart->CTRLB = (usart->CTRLB & ~USART_RXMODE_gm) | rxmode;
+	usart_rx_reset(port);
+	usart->CTRLB |= USART_RXEN_bm;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		usart->CTRLA |= USART_RXCIE_bm;
+	}
+	if (!found) {
+		return 0;
+	}
+	return (64UL * F_CPU + (uint32_t)s * baud / 2) / ((uint32_t)s * baud);
+}
+#endif
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// ISR HANDLERS
+// Both handlers loop on their flag so one interrupt can move the two bytes the
+// hardware buffers hold; the receiver has a 2-level FIFO and the transmitter
+// has a data register in front of its shift register. A burst so pays one
+// entry and exit per two bytes instead of one per byte.
+// Vectors pass the unit and ring addresses as constants. With USART_ISR_FASTPATH
+// the handlers are inlined into every vector, so those addresses fold into
+// direct accesses; otherwise all vectors share one out-of-line copy of each
+// handler. Anything but a plain byte goes to an out-of-line function, so the
+// byte path makes no call. The vector still contains those calls, and
+// avr-gcc then saves every call-clobbered register on entry either way.
+#ifdef USART_ISR_FASTPATH
+#define USART_HANDLER static inline __attribute__((always_inline))
+#else
+#define USART_HANDLER static
+#endif
+
+// Any byte that is not a plain store: an error or ninth bit, a byte lost
+// before it, a full ring or a frame to assemble
+static __attribute__((noinline)) void usart_rx_byte_slow(usart_port* port, USART_t* usart,
+		ringbuffer* rx, uint8_t error, char data) {
+	if (port->rx_filter && (error & USART_DATA8_bm)) {	// Address frame; not stored
+		if (!(error & (USART_PERR_bm | USART_FERR_bm)) &&
+			((uint8_t)data == port->rx_address || (uint8_t)data == port->rx_broadcast)) {
+			usart->CTRLB &= ~USART_MPCM_bm;			// Ours; take the data frames that follow
+		}
+		else {
+			usart->CTRLB |= USART_MPCM_bm;			// Another node's; the unit drops its data
+		}
+		return;
+	}
+	bool stored = false;
+	if (!rbuffer_full(rx) || usart_rx_overflow(port, usart, rx)) {
+		uint8_t code = usart_rx_status(error);
+		if (port->rx_lost) {
+			code |= USART_RX_OVERFLOW;				// Keeps the byte's own errors
+		}
+		if (!code || usart_rx_set_flag(port, rx->in, code)) {
+			port->rx_lost = false;
+			rbuffer_insert(data, rx);
+			USART_STAT_ADD(port, rx_bytes, 1);
+			USART_STAT_MAX(port, rx_high_water, rbuffer_count(rx));
+#ifdef USART_FRAME_QUEUE
+			if (port->frame_mode) {
+				usart_frame_byte(port, rx, data);
+			}
+#endif
+			stored = true;
+		}
+		else {
+			port->rx_lost = true;					// No mark free; flag the next byte
+			USART_STAT_ADD(port, rx_dropped, 1);
+		}
+	}
+#ifdef USART_FRAME_QUEUE
+	if (!stored && port->frame_mode && port->frame_count) {
+		usart_frame_close(port, rx->in, true);		// Dropped part of it
+	}
+#endif
+#ifdef USART_STATS_ENABLE
+	if (error & USART_PERR_bm) {
+		USART_STAT_ADD(port, parity_errors, 1);
+	}
+	if (error & USART_FERR_bm) {
+		USART_STAT_ADD(port, frame_errors, 1);
+	}
+	if (error & USART_BUFOVF_bm) {
+		USART_STAT_ADD(port, overruns, 1);
+	}
+#endif
+}
+
+// The byte path: stored as it is, with no call
+static inline bool usart_rx_plain(usart_port* port, ringbuffer* rx, uint8_t error) {
+#ifdef USART_FRAME_QUEUE
+	if (port->frame_mode) {
+		return false;
 	}
+#endif
+	return !(error & (USART_RX_ERROR_MASK | USART_DATA8_bm)) && !port->rx_lost && !rbuffer_full(rx);
 }
 
-// Disable unit Tx and Rx before its interrupts!
-void usart5_close(void) {
-	while(!rbuffer_empty(&rb_tx5)); 				// Wait for Tx to finish all character in ring buffer
-	while(!(USART5.STATUS & USART_DREIF_bm)); 		// Wait for Tx unit to finish the last character of ringbuffer
+USART_HANDLER void usart_rxc_handler(usart_port* port, USART_t* usart, ringbuffer* rx) {
+	if (usart->CTRLB & USART_SFDEN_bm) {
+		USART_STATUS_WRITE(usart, USART_RXSIF_bm);	// Start detected in STANDBY; RXSIE stays off
+	}
+	do {
+		uint8_t error = usart->RXDATAH;				// Must be read before RXDATAL pops the FIFO
+		char data = USART_RXDATAL_READ(usart);
+		if (usart_rx_plain(port, rx, error)) {
+			rbuffer_insert(data, rx);
+			USART_STAT_ADD(port, rx_bytes, 1);
+			USART_STAT_MAX(port, rx_high_water, rbuffer_count(rx));
+		}
+		else {
+			usart_rx_byte_slow(port, usart, rx, error, data);
+		}
+	} while (usart->STATUS & USART_RXCIF_bm);
+}
 
-	_delay_ms(200); 								// Extra safety for Tx to finish!
+// Runs the hook once the TX ring has drained to the watermark
+static __attribute__((noinline)) void usart_tx_hook_fire(usart_port* port) {
+	port->tx_hook_armed = false;
+	port->tx_hook(port);							// Runs in interrupt context
+}
 
-	USART5.CTRLB &= ~USART_RXEN_bm; 				// Disable Rx unit
-	USART5.CTRLB &= ~USART_TXEN_bm; 				// Disable Rx unit
+USART_HANDLER void usart_dre_handler(usart_port* port, USART_t* usart, ringbuffer* tx) {
+	if (port->tx_data8) {							// DREIF is set, so TXDATAH takes it
+		USART_TXDATAH_WRITE(usart, 0);				// Data frames after an address
+		port->tx_data8 = false;
+	}
+	do {
+		if (rbuffer_empty(tx)) {
+			usart->CTRLA &= ~USART_DREIE_bm;		// Nothing left; stop Tx interrupt
+			break;
+		}
+		USART_STATUS_WRITE(usart, USART_TXCIF_bm);	// TXCIF now tracks this character
+		USART_TXDATAL_WRITE(usart, rbuffer_remove(tx));
+		USART_STAT_ADD(port, tx_bytes, 1);
+	} while (usart->STATUS & USART_DREIF_bm);
+	if (port->tx_hook_armed && rbuffer_free(tx) >= port->tx_watermark) {
+		usart_tx_hook_fire(port);
+	}
+}
 
-	USART5.CTRLA &= ~USART_RXCIE_bm;				// Disable Rx interrupt
-	USART5.CTRLA &= ~USART_DREIE_bm;				// Disable Tx interrupt
+// Only enabled while closing; TXCIF with data still queued is an idle gap
+// between writes, not the end of transmission
+USART_HANDLER void usart_txc_handler(usart_port* port, USART_t* usart, ringbuffer* tx) {
+	if (!rbuffer_empty(tx)) {
+		USART_STATUS_WRITE(usart, USART_TXCIF_bm);
+		return;
+	}
+	usart_shutdown(port);
 }
-#endif
 
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-// USART0 ISR FUNCTIONS
+// ISR VECTORS
 #ifdef USART0_ENABLE
 ISR(USART0_RXC_vect) {
-    char data = USART0.RXDATAL;
-	rbuffer_insert(data, &rb_rx0);
-	usart0_error = USART0.RXDATAH;
+	usart_rxc_handler(&USART0_port, &USART0, &rb_rx0);
 }
 
 ISR(USART0_DRE_vect) {
-	if(!rbuffer_empty(&rb_tx0)) {
-		USART0.TXDATAL = rbuffer_remove(&rb_tx0);
-	}
-	else {
-		USART0.CTRLA &= ~USART_DREIE_bm;
-	}
+	usart_dre_handler(&USART0_port, &USART0, &rb_tx0);
+}
+
+ISR(USART0_TXC_vect) {
+	usart_txc_handler(&USART0_port, &USART0, &rb_tx0);
+}
+#endif
+
+#if defined(USART0_ENABLE) && defined(USART_FRAME_QUEUE) && defined(USART0_GAP_TIMER)
+ISR(USART0_GAP_TIMER_vect) {
+	usart_gap_handler(&USART0_port);
 }
 #endif
 
-// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-// USART1 ISR FUNCTIONS
 #ifdef USART1_ENABLE
 ISR(USART1_RXC_vect) {
-    char data = USART1.RXDATAL;
-	rbuffer_insert(data, &rb_rx1);
-	usart1_error = USART1.RXDATAH;
+	usart_rxc_handler(&USART1_port, &USART1, &rb_rx1);
 }
 
 ISR(USART1_DRE_vect) {
-	if(!rbuffer_empty(&rb_tx1)) {
-		USART1.TXDATAL = rbuffer_remove(&rb_tx1);
-	}
-	else {
-		USART1.CTRLA &= ~USART_DREIE_bm;
-	}
+	usart_dre_handler(&USART1_port, &USART1, &rb_tx1);
+}
+
+ISR(USART1_TXC_vect) {
+	usart_txc_handler(&USART1_port, &USART1, &rb_tx1);
+}
+#endif
+
+#if defined(USART1_ENABLE) && defined(USART_FRAME_QUEUE) && defined(USART1_GAP_TIMER)
+ISR(USART1_GAP_TIMER_vect) {
+	usart_gap_handler(&USART1_port);
 }
 #endif
 
-// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-// USART2 ISR FUNCTIONS
 #ifdef USART2_ENABLE
 ISR(USART2_RXC_vect) {
-    char data = USART2.RXDATAL;
-	rbuffer_insert(data, &rb_rx2);
-	usart2_error = USART2.RXDATAH;
+	usart_rxc_handler(&USART2_port, &USART2, &rb_rx2);
 }
 
 ISR(USART2_DRE_vect) {
-	if(!rbuffer_empty(&rb_tx2)) {
-		USART2.TXDATAL = rbuffer_remove(&rb_tx2);
-	}
-	else {
-		USART2.CTRLA &= ~USART_DREIE_bm;
-	}
+	usart_dre_handler(&USART2_port, &USART2, &rb_tx2);
+}
+
+ISR(USART2_TXC_vect) {
+	usart_txc_handler(&USART2_port, &USART2, &rb_tx2);
+}
+#endif
+
+#if defined(USART2_ENABLE) && defined(USART_FRAME_QUEUE) && defined(USART2_GAP_TIMER)
+ISR(USART2_GAP_TIMER_vect) {
+	usart_gap_handler(&USART2_port);
 }
 #endif
 
-// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-// USART3 ISR FUNCTIONS
 #ifdef USART3_ENABLE
 ISR(USART3_RXC_vect) {
-    char data = USART3.RXDATAL;
-	rbuffer_insert(data, &rb_rx3);
-	usart3_error = USART0.RXDATAH;
+	usart_rxc_handler(&USART3_port, &USART3, &rb_rx3);
 }
 
 ISR(USART3_DRE_vect) {
-	if(!rbuffer_empty(&rb_tx3)) {
-		USART3.TXDATAL = rbuffer_remove(&rb_tx3);
-	}
-	else {
-		USART3.CTRLA &= ~USART_DREIE_bm;
-	}
+	usart_dre_handler(&USART3_port, &USART3, &rb_tx3);
+}
+
+ISR(USART3_TXC_vect) {
+	usart_txc_handler(&USART3_port, &USART3, &rb_tx3);
+}
+#endif
+
+#if defined(USART3_ENABLE) && defined(USART_FRAME_QUEUE) && defined(USART3_GAP_TIMER)
+ISR(USART3_GAP_TIMER_vect) {
+	usart_gap_handler(&USART3_port);
 }
 #endif
 
-// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-// USART4 ISR FUNCTIONS
 #ifdef USART4_ENABLE
 ISR(USART4_RXC_vect) {
-    char data = USART4.RXDATAL;
-	rbuffer_insert(data, &rb_rx4);
-	usart4_error = USART4.RXDATAH;
+	usart_rxc_handler(&USART4_port, &USART4, &rb_rx4);
 }
 
 ISR(USART4_DRE_vect) {
-	if(!rbuffer_empty(&rb_tx4)) {
-		USART4.TXDATAL = rbuffer_remove(&rb_tx4);
-	}
-	else {
-		USART4.CTRLA &= ~USART_DREIE_bm;
-	}
+	usart_dre_handler(&USART4_port, &USART4, &rb_tx4);
+}
+
+ISR(USART4_TXC_vect) {
+	usart_txc_handler(&USART4_port, &USART4, &rb_tx4);
+}
+#endif
+
+#if defined(USART4_ENABLE) && defined(USART_FRAME_QUEUE) && defined(USART4_GAP_TIMER)
+ISR(USART4_GAP_TIMER_vect) {
+	usart_gap_handler(&USART4_port);
 }
 #endif
 
-// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-// USART5 ISR FUNCTIONS
 #ifdef USART5_ENABLE
 ISR(USART5_RXC_vect) {
-    char data = USART5.RXDATAL;
-	rbuffer_insert(data, &rb_rx5);
-	usart5_error = USART5.RXDATAH;
+	usart_rxc_handler(&USART5_port, &USART5, &rb_rx5);
 }
 
 ISR(USART5_DRE_vect) {
-	if(!rbuffer_empty(&rb_tx5)) {
-		USART5.TXDATAL = rbuffer_remove(&rb_tx5);
-	}
-	else {
-		USART5.CTRLA &= ~USART_DREIE_bm;
-	}
+	usart_dre_handler(&USART5_port, &USART5, &rb_tx5);
+}
+
+ISR(USART5_TXC_vect) {
+	usart_txc_handler(&USART5_port, &USART5, &rb_tx5);
 }
-#endif
\ No newline at end of file
+#endif
+
+#if defined(USART5_ENABLE) && defined(USART_FRAME_QUEUE) && defined(USART5_GAP_TIMER)
+ISR(USART5_GAP_TIMER_vect) {
+	usart_gap_handler(&USART5_port);
+}
+#endif
@@ -6,68 +6,372 @@
  *          Date:     2023-05-08           
  */
 
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include "uart_settings.h"
 
-#define USART_BUFFER_OVERFLOW    0x6400      // ==USART_BUFOVF_bm  
+// Error flags returned with each byte; they describe that byte only
+#define USART_BUFFER_OVERFLOW    0x4000      // ==USART_BUFOVF_bm; also marks the byte after data lost to a full ring,
+                                             // or comes with USART_NO_DATA when nothing followed the loss
 #define USART_FRAME_ERROR        0x0400      // ==USART_FERR_bm             
 #define USART_PARITY_ERROR       0x0200      // ==USART_PERR_bm      
 #define USART_NO_DATA            0x0100      
 
-#define BAUD_RATE(BAUD_RATE) ((float)(F_CPU * 64 / (16 * (float)BAUD_RATE)) + 0.5)
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// BAUD RATE & FRAME FORMAT
+// BAUD = 64 * F_CPU / (S * baud) with S = 16 in normal and S = 8 in CLK2X mode.
+// Everything below folds to constants; USART_CONFIG fails the build when the
+// rate is not reachable within USART_BAUD_TOLERANCE in either mode.
+#ifndef USART_BAUD_TOLERANCE
+#define USART_BAUD_TOLERANCE     20          // Permille
+#endif
+
+#define USART_BAUD_REG(baud, s)      ((64ULL * F_CPU + (s) * (baud) / 2) / ((s) * (uint64_t)(baud)))
+#define USART_BAUD_DIFF(baud, s)     ((64ULL * F_CPU > (s) * (baud) * USART_BAUD_REG(baud, s)) ? \
+                                      (64ULL * F_CPU - (s) * (baud) * USART_BAUD_REG(baud, s)) : \
+                                      ((s) * (baud) * USART_BAUD_REG(baud, s) - 64ULL * F_CPU))
+#define USART_BAUD_ERROR(baud, s)    (USART_BAUD_DIFF(baud, s) * 1000 / ((s) * (baud) * USART_BAUD_REG(baud, s)))
+#define USART_BAUD_OK(baud, s)       (USART_BAUD_REG(baud, s) >= 64 && USART_BAUD_REG(baud, s) <= 0xFFFF && \
+                                      USART_BAUD_ERROR(baud, s) <= USART_BAUD_TOLERANCE)
+
+// Normal mode samples more robustly, so CLK2X is used only when normal mode fails
+#define USART_BAUD_CLK2X(baud)       (!USART_BAUD_OK(baud, 16))
+#define USART_BAUD_S(baud)           (USART_BAUD_CLK2X(baud) ? 8 : 16)
+#define USART_BAUD_CHECKED(baud)     ((uint16_t)(USART_BAUD_REG(baud, USART_BAUD_S(baud)) + 0 * sizeof(struct { \
+                                      _Static_assert(USART_BAUD_OK(baud, USART_BAUD_S(baud)), \
+                                      "baud rate " #baud " is not reachable within USART_BAUD_TOLERANCE"); char c; })))
+
+#define USART_FORMAT(chsize, pmode, sbmode)  (USART_CMODE_ASYNCHRONOUS_gc | (chsize) | (pmode) | (sbmode))
+#define USART_FORMAT_8N1         USART_FORMAT(USART_CHSIZE_8BIT_gc, USART_PMODE_DISABLED_gc, USART_SBMODE_1BIT_gc)
+#define USART_FORMAT_8N2         USART_FORMAT(USART_CHSIZE_8BIT_gc, USART_PMODE_DISABLED_gc, USART_SBMODE_2BIT_gc)
+#define USART_FORMAT_8E1         USART_FORMAT(USART_CHSIZE_8BIT_gc, USART_PMODE_EVEN_gc, USART_SBMODE_1BIT_gc)
+#define USART_FORMAT_8O1         USART_FORMAT(USART_CHSIZE_8BIT_gc, USART_PMODE_ODD_gc, USART_SBMODE_1BIT_gc)
+#define USART_FORMAT_7E1         USART_FORMAT(USART_CHSIZE_7BIT_gc, USART_PMODE_EVEN_gc, USART_SBMODE_1BIT_gc)
+// Nine data bits, high byte first; the ninth marks address frames, see usart_set_address
+#define USART_FORMAT_9N1         USART_FORMAT(USART_CHSIZE_9BITH_gc, USART_PMODE_DISABLED_gc, USART_SBMODE_1BIT_gc)
+
+typedef struct {
+    uint16_t baud;                           // BAUD register value
+    uint8_t  rxmode;                         // CTRLB RXMODE; normal or CLK2X
+    uint8_t  format;                         // CTRLC; character size, parity and stop bits
+    uint8_t  options;                        // USART_OPTION_* flags
+} usart_config_t;
+
+// Start-of-frame detection: in STANDBY the falling edge of a start bit powers
+// up the oscillator on demand, the character is received and its RXC interrupt
+// wakes the CPU with the byte in the RX ring. The oscillator must be up within
+// the first half of the start bit, so check its start-up time against the baud
+// rate. Other units and timers stay stopped, so finish sending before STANDBY.
+#define USART_OPTION_WAKE        0x01        // Wake from STANDBY on incoming data
+
+// RS-485: the unit drives its XDIR pin, USARTn_XDIR_PORT and USARTn_XDIR_PIN_bm
+// in uart_settings.h, high while it transmits, so an external transceiver's
+// driver enable needs no software. Tie the transceiver's receiver enable to
+// the same pin, or the node receives what it sends.
+#define USART_OPTION_RS485       0x02        // Drive XDIR for an RS-485 transceiver
+
+#define USART_CONFIG_OPTIONS(baud, format, options)  ((usart_config_t){ USART_BAUD_CHECKED(baud), \
+                                      USART_BAUD_CLK2X(baud) ? USART_RXMODE_CLK2X_gc : USART_RXMODE_NORMAL_gc, \
+                                      (format), (options) })
+#define USART_CONFIG(baud, format)   USART_CONFIG_OPTIONS(baud, format, 0)
+
+// Normal mode with a BAUD register value the caller worked out, as code
+// written for BAUD_RATE does; not checked against USART_BAUD_TOLERANCE
+#define USART_CONFIG_RAW(reg, format)  ((usart_config_t){ (uint16_t)(reg), USART_RXMODE_NORMAL_gc, (format), 0 })
+
+// Normal mode BAUD register value, for USART_CONFIG_RAW
+#define BAUD_RATE(BAUD_RATE)     ((uint16_t)USART_BAUD_REG(BAUD_RATE, 16))
 
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
 // USART FUNCTIONS
+// One generic driver serves all units; usartN_* are thin wrappers around it
+typedef struct usart_port usart_port;
+typedef void (*usart_tx_hook)(usart_port* port);
+typedef void (*usart_close_hook)(usart_port* port);
+
+// Stream modes; the TX mode may be or'ed with the RX modes. Reads that hit a
+// byte with error flags, or a receiver stopped by USART_RX_STOP, return
+// _FDEV_ERR and need clearerr() like any stdio error.
+#define USART_STREAM_BLOCKING    0x00        // Stream waits for TX space and for RX data
+#define USART_STREAM_DROP        0x01        // Stream drops what does not fit
+#define USART_STREAM_NONBLOCK    0x02        // Stream reads _FDEV_EOF while nothing is ready
+#define USART_STREAM_LINE        0x04        // Stream reads nothing until a '\n' or a full RX ring is in
+
+// RX overflow policies; the reader sees USART_BUFFER_OVERFLOW where data was lost
+#define USART_RX_DROP_NEWEST     0           // Full RX ring discards the incoming byte
+#define USART_RX_DROP_OLDEST     1           // Full RX ring discards its oldest byte; peeked data may be overwritten
+#define USART_RX_STOP            2           // Full RX ring stops the receiver until usart_rx_resume
+
+void usart_init(usart_port* port, usart_config_t config);
+void usart_send_char(usart_port* port, char c);
+void usart_send_string(usart_port* port, char* str, uint8_t len);
+size_t usart_write(usart_port* port, const void* data, size_t len);
+uint8_t usart_try_send(usart_port* port, char c);
+size_t usart_try_write(usart_port* port, const void* data, size_t len);
+size_t usart_tx_free(usart_port* port);
+size_t usart_tx_reserve(usart_port* port, char** data);             // Contiguous free TX space
+void usart_tx_commit(usart_port* port, size_t len);
+void usart_set_tx_hook(usart_port* port, size_t watermark, usart_tx_hook hook);
+void usart_set_stream_mode(usart_port* port, uint8_t mode);
+uint16_t usart_read_char(usart_port* port);
+size_t usart_rx_peek(usart_port* port, const char** data);       // Stops before a byte with error flags
+void usart_rx_commit(usart_port* port, size_t len);
+void usart_set_rx_policy(usart_port* port, uint8_t policy);
+void usart_rx_resume(usart_port* port);
+void usart_set_address(usart_port* port, uint8_t address, uint8_t broadcast);   // Multidrop receiver
+void usart_clear_address(usart_port* port);
+void usart_send_address(usart_port* port, uint8_t address);          // After what is queued
+void usart_close(usart_port* port);
+void usart_close_async(usart_port* port, usart_close_hook hook);
+bool usart_closing(usart_port* port);
+
+#ifdef USART_FRAME_QUEUE
+typedef void (*usart_frame_hook)(usart_port* port);
+
+// Frame assembler modes; the RXC ISR finds frame ends and queues them
+#define USART_FRAME_OFF          0
+#define USART_FRAME_DELIMITER    1           // Frame ends with the byte value, which is part of it
+#define USART_FRAME_LENGTH       2           // Frame is value bytes long, at most the RX ring size
+#define USART_FRAME_GAP          3           // Frame ends after value bit times of silence; needs USARTn_GAP_TIMER
+
+void usart_set_frame(usart_port* port, uint8_t mode, uint16_t value, usart_frame_hook hook);
+uint8_t usart_frames(usart_port* port);                             // Complete frames queued
+uint16_t usart_frame_time(usart_port* port);                        // USART_TIMESTAMP when the oldest frame ended
+size_t usart_read_frame(usart_port* port, void* buf, size_t size, uint16_t* errors);
+#endif
+
+#ifdef USART_TIMER
+#define USART_AUTOBAUD_HW        0           // Break and 0x55 sync field, measured by the USART
+#define USART_AUTOBAUD_SOFT      1           // 0x55 sync character, timed on the Rx pin with USART_TIMER
+
+uint32_t usart_autobaud(usart_port* port, uint8_t method, uint16_t timeout_ms);
+
+#define USART_WAIT_PORT(n)       (1 << (n))  // Port bits for usart_wait_any
+uint8_t usart_wait_any(uint8_t ports, uint16_t timeout_ms);
+#endif
+
+#ifdef USART_STATS_ENABLE
+typedef struct {
+    uint32_t rx_bytes;                       // Bytes stored in the RX ring
+    uint32_t tx_bytes;                       // Bytes handed to the transmitter
+    uint16_t rx_dropped;                     // Bytes lost to a full RX ring
+    uint16_t parity_errors;
+    uint16_t frame_errors;
+    uint16_t overruns;                       // Hardware receive buffer overflows
+    uint16_t rx_high_water;                  // Highest RX ring fill level seen
+    uint16_t tx_high_water;                  // Highest TX ring fill level seen
+    uint16_t tx_blocked;                     // Sends that had to wait for TX space
+    uint16_t frames;                         // Frames completed by the assembler
+    uint16_t frames_merged;                  // Frames joined to the previous one on a full queue
+} usart_stats_t;
+
+void usart_get_stats(usart_port* port, usart_stats_t* stats);
+void usart_reset_stats(usart_port* port);
+#endif
+
 #ifdef USART0_ENABLE
 extern FILE USART0_stream;
-void usart0_init(uint16_t baud_rate);
-void usart0_send_char(char c);
-void usart0_send_string(char* str, uint8_t len);
-uint16_t usart0_read_char(void);
-void usart0_close(void);
+extern usart_port USART0_port;
+#define usart0_init(config)              usart_init(&USART0_port, config)
+#define usart0_send_char(c)              usart_send_char(&USART0_port, c)
+#define usart0_send_string(str, len)     usart_send_string(&USART0_port, str, len)
+#define usart0_write(data, len)          usart_write(&USART0_port, data, len)
+#define usart0_try_send(c)               usart_try_send(&USART0_port, c)
+#define usart0_try_write(data, len)      usart_try_write(&USART0_port, data, len)
+#define usart0_tx_free()                 usart_tx_free(&USART0_port)
+#define usart0_tx_reserve(data)          usart_tx_reserve(&USART0_port, data)
+#define usart0_tx_commit(len)            usart_tx_commit(&USART0_port, len)
+#define usart0_set_tx_hook(level, hook)  usart_set_tx_hook(&USART0_port, level, hook)
+#define usart0_set_stream_mode(mode)     usart_set_stream_mode(&USART0_port, mode)
+#define usart0_read_char()               usart_read_char(&USART0_port)
+#define usart0_rx_peek(data)             usart_rx_peek(&USART0_port, data)
+#define usart0_rx_commit(len)            usart_rx_commit(&USART0_port, len)
+#define usart0_set_rx_policy(policy)     usart_set_rx_policy(&USART0_port, policy)
+#define usart0_rx_resume()               usart_rx_resume(&USART0_port)
+#define usart0_set_address(addr, bcast)  usart_set_address(&USART0_port, addr, bcast)
+#define usart0_clear_address()           usart_clear_address(&USART0_port)
+#define usart0_send_address(addr)        usart_send_address(&USART0_port, addr)
+#define usart0_close()                   usart_close(&USART0_port)
+#define usart0_close_async(hook)         usart_close_async(&USART0_port, hook)
+#define usart0_closing()                 usart_closing(&USART0_port)
+#define usart0_set_frame(mode, v, hook)  usart_set_frame(&USART0_port, mode, v, hook)
+#define usart0_frames()                  usart_frames(&USART0_port)
+#define usart0_frame_time()              usart_frame_time(&USART0_port)
+#define usart0_read_frame(buf, size, e)  usart_read_frame(&USART0_port, buf, size, e)
+#define usart0_autobaud(method, ms)      usart_autobaud(&USART0_port, method, ms)
+#define usart0_get_stats(stats)          usart_get_stats(&USART0_port, stats)
+#define usart0_reset_stats()             usart_reset_stats(&USART0_port)
 #endif
 
 #ifdef USART1_ENABLE
 extern FILE USART1_stream;
-void usart1_init(uint16_t baud_rate);
-void usart1_send_char(char c);
-void usart1_send_string(char* str, uint8_t len);
-uint16_t usart1_read_char(void);
-void usart1_close(void);
+extern usart_port USART1_port;
+#define usart1_init(config)              usart_init(&USART1_port, config)
+#define usart1_send_char(c)              usart_send_char(&USART1_port, c)
+#define usart1_send_string(str, len)     usart_send_string(&USART1_port, str, len)
+#define usart1_write(data, len)          usart_write(&USART1_port, data, len)
+#define usart1_try_send(c)               usart_try_send(&USART1_port, c)
+#define usart1_try_write(data, len)      usart_try_write(&USART1_port, data, len)
+#define usart1_tx_free()                 usart_tx_free(&USART1_port)
+#define usart1_tx_reserve(data)          usart_tx_reserve(&USART1_port, data)
+#define usart1_tx_commit(len)            usart_tx_commit(&USART1_port, len)
+#define usart1_set_tx_hook(level, hook)  usart_set_tx_hook(&USART1_port, level, hook)
+#define usart1_set_stream_mode(mode)     usart_set_stream_mode(&USART1_port, mode)
+#define usart1_read_char()               usart_read_char(&USART1_port)
+#define usart1_rx_peek(data)             usart_rx_peek(&USART1_port, data)
+#define usart1_rx_commit(len)            usart_rx_commit(&USART1_port, len)
+#define usart1_set_rx_policy(policy)     usart_set_rx_policy(&USART1_port, policy)
+#define usart1_rx_resume()               usart_rx_resume(&USART1_port)
+#define usart1_set_address(addr, bcast)  usart_set_address(&USART1_port, addr, bcast)
+#define usart1_clear_address()           usart_clear_address(&USART1_port)
+#define usart1_send_address(addr)        usart_send_address(&USART1_port, addr)
+#define usart1_close()                   usart_close(&USART1_port)
+#define usart1_close_async(hook)         usart_close_async(&USART1_port, hook)
+#define usart1_closing()                 usart_closing(&USART1_port)
+#define usart1_set_frame(mode, v, hook)  usart_set_frame(&USART1_port, mode, v, hook)
+#define usart1_frames()                  usart_frames(&USART1_port)
+#define usart1_frame_time()              usart_frame_time(&USART1_port)
+#define usart1_read_frame(buf, size, e)  usart_read_frame(&USART1_port, buf, size, e)
+#define usart1_autobaud(method, ms)      usart_autobaud(&USART1_port, method, ms)
+#define usart1_get_stats(stats)          usart_get_stats(&USART1_port, stats)
+#define usart1_reset_stats()             usart_reset_stats(&USART1_port)
 #endif
 
 #ifdef USART2_ENABLE
 extern FILE USART2_stream;
-void usart2_init(uint16_t baud_rate);
-void usart2_send_char(char c);
-void usart2_send_string(char* str, uint8_t len);
-uint16_t usart2_read_char(void);
-void usart2_close(void);
+extern usart_port USART2_port;
+#define usart2_init(config)              usart_init(&USART2_port, config)
+#define usart2_send_char(c)              usart_send_char(&USART2_port, c)
+#define usart2_send_string(str, len)     usart_send_string(&USART2_port, str, len)
+#define usart2_write(data, len)          usart_write(&USART2_port, data, len)
+#define usart2_try_send(c)               usart_try_send(&USART2_port, c)
+#define usart2_try_write(data, len)      usart_try_write(&USART2_port, data, len)
+#define usart2_tx_free()                 usart_tx_free(&USART2_port)
+#define usart2_tx_reserve(data)          usart_tx_reserve(&USART2_port, data)
+#define usart2_tx_commit(len)            usart_tx_commit(&USART2_port, len)
+#define usart2_set_tx_hook(level, hook)  usart_set_tx_hook(&USART2_port, level, hook)
+#define usart2_set_stream_mode(mode)     usart_set_stream_mode(&USART2_port, mode)
+#define usart2_read_char()               usart_read_char(&USART2_port)
+#define usart2_rx_peek(data)             usart_rx_peek(&USART2_port, data)
+#define usart2_rx_commit(len)            usart_rx_commit(&USART2_port, len)
+#define usart2_set_rx_policy(policy)     usart_set_rx_policy(&USART2_port, policy)
+#define usart2_rx_resume()               usart_rx_resume(&USART2_port)
+#define usart2_set_address(addr, bcast)  usart_set_address(&USART2_port, addr, bcast)
+#define usart2_clear_address()           usart_clear_address(&USART2_port)
+#define usart2_send_address(addr)        usart_send_address(&USART2_port, addr)
+#define usart2_close()                   usart_close(&USART2_port)
+#define usart2_close_async(hook)         usart_close_async(&USART2_port, hook)
+#define usart2_closing()                 usart_closing(&USART2_port)
+#define usart2_set_frame(mode, v, hook)  usart_set_frame(&USART2_port, mode, v, hook)
+#define usart2_frames()                  usart_frames(&USART2_port)
+#define usart2_frame_time()              usart_frame_time(&USART2_port)
+#define usart2_read_frame(buf, size, e)  usart_read_frame(&USART2_port, buf, size, e)
+#define usart2_autobaud(method, ms)      usart_autobaud(&USART2_port, method, ms)
+#define usart2_get_stats(stats)          usart_get_stats(&USART2_port, stats)
+#define usart2_reset_stats()             usart_reset_stats(&USART2_port)
 #endif
 
 #ifdef USART3_ENABLE
 extern FILE USART3_stream;
-void usart3_init(uint16_t baud_rate);
-void usart3_send_char(char c);
-void usart3_send_string(char* str, uint8_t len);
-uint16_t usart3_read_char(void);
-void usart3_close(void);
+extern usart_port USART3_port;
+#define usart3_init(config)              usart_init(&USART3_port, config)
+#define usart3_send_char(c)              usart_send_char(&USART3_port, c)
+#define usart3_send_string(str, len)     usart_send_string(&USART3_port, str, len)
+#define usart3_write(data, len)          usart_write(&USART3_port, data, len)
+#define usart3_try_send(c)               usart_try_send(&USART3_port, c)
+#define usart3_try_write(data, len)      usart_try_write(&USART3_port, data, len)
+#define usart3_tx_free()                 usart_tx_free(&USART3_port)
+#define usart3_tx_reserve(data)          usart_tx_reserve(&USART3_port, data)
+#define usart3_tx_commit(len)            usart_tx_commit(&USART3_port, len)
+#define usart3_set_tx_hook(level, hook)  usart_set_tx_hook(&USART3_port, level, hook)
+#define usart3_set_stream_mode(mode)     usart_set_stream_mode(&USART3_port, mode)
+#define usart3_read_char()               usart_read_char(&USART3_port)
+#define usart3_rx_peek(data)             usart_rx_peek(&USART3_port, data)
+#define usart3_rx_commit(len)            usart_rx_commit(&USART3_port, len)
+#define usart3_set_rx_policy(policy)     usart_set_rx_policy(&USART3_port, policy)
+#define usart3_rx_resume()               usart_rx_resume(&USART3_port)
+#define usart3_set_address(addr, bcast)  usart_set_address(&USART3_port, addr, bcast)
+#define usart3_clear_address()           usart_clear_address(&USART3_port)
+#define usart3_send_address(addr)        usart_send_address(&USART3_port, addr)
+#define usart3_close()                   usart_close(&USART3_port)
+#define usart3_close_async(hook)         usart_close_async(&USART3_port, hook)
+#define usart3_closing()                 usart_closing(&USART3_port)
+#define usart3_set_frame(mode, v, hook)  usart_set_frame(&USART3_port, mode, v, hook)
+#define usart3_frames()                  usart_frames(&USART3_port)
+#define usart3_frame_time()              usart_frame_time(&USART3_port)
+#define usart3_read_frame(buf, size, e)  usart_read_frame(&USART3_port, buf, size, e)
+#define usart3_autobaud(method, ms)      usart_autobaud(&USART3_port, method, ms)
+#define usart3_get_stats(stats)          usart_get_stats(&USART3_port, stats)
+#define usart3_reset_stats()             usart_reset_stats(&USART3_port)
 #endif
 
 #ifdef USART4_ENABLE
 extern FILE USART4_stream;
-void usart4_init(uint16_t baud_rate);
-void usart4_send_char(char c);
-void usart4_send_string(char* str, uint8_t len);
-uint16_t usart4_read_char(void);
-void usart4_close(void);
+extern usart_port USART4_port;
+#define usart4_init(config)              usart_init(&USART4_port, config)
+#define usart4_send_char(c)              usart_send_char(&USART4_port, c)
+#define usart4_send_string(str, len)     usart_send_string(&USART4_port, str, len)
+#define usart4_write(data, len)          usart_write(&USART4_port, data, len)
+#define usart4_try_send(c)               usart_try_send(&USART4_port, c)
+#define usart4_try_write(data, len)      usart_try_write(&USART4_port, data, len)
+#define usart4_tx_free()                 usart_tx_free(&USART4_port)
+#define usart4_tx_reserve(data)          usart_tx_reserve(&USART4_port, data)
+#define usart4_tx_commit(len)            usart_tx_commit(&USART4_port, len)
+#define usart4_set_tx_hook(level, hook)  usart_set_tx_hook(&USART4_port, level, hook)
+#define usart4_set_stream_mode(mode)     usart_set_stream_mode(&USART4_port, mode)
+#define usart4_read_char()               usart_read_char(&USART4_port)
+#define usart4_rx_peek(data)             usart_rx_peek(&USART4_port, data)
+#define usart4_rx_commit(len)            usart_rx_commit(&USART4_port, len)
+#define usart4_set_rx_policy(policy)     usart_set_rx_policy(&USART4_port, policy)
+#define usart4_rx_resume()               usart_rx_resume(&USART4_port)
+#define usart4_set_address(addr, bcast)  usart_set_address(&USART4_port, addr, bcast)
+#define usart4_clear_address()           usart_clear_address(&USART4_port)
+#define usart4_send_address(addr)        usart_send_address(&USART4_port, addr)
+#define usart4_close()                   usart_close(&USART4_port)
+#define usart4_close_async(hook)         usart_close_async(&USART4_port, hook)
+#define usart4_closing()                 usart_closing(&USART4_port)
+#define usart4_set_frame(mode, v, hook)  usart_set_frame(&USART4_port, mode, v, hook)
+#define usart4_frames()                  usart_frames(&USART4_port)
+#define usart4_frame_time()              usart_frame_time(&USART4_port)
+#define usart4_read_frame(buf, size, e)  usart_read_frame(&USART4_port, buf, size, e)
+#define usart4_autobaud(method, ms)      usart_autobaud(&USART4_port, method, ms)
+#define usart4_get_stats(stats)          usart_get_stats(&USART4_port, stats)
+#define usart4_reset_stats()             usart_reset_stats(&USART4_port)
 #endif
 
 #ifdef USART5_ENABLE
 extern FILE USART5_stream;
-void usart5_init(uint16_t baud_rate);
-void usart5_send_char(char c);
-void usart5_send_string(char* str, uint8_t len);
-uint16_t usart5_read_char(void);
-void usart5_close(void);
+extern usart_port USART5_port;
+#define usart5_init(config)              usart_init(&USART5_port, config)
+#define usart5_send_char(c)              usart_send_char(&USART5_port, c)
+#define usart5_send_string(str, len)     usart_send_string(&USART5_port, str, len)
+#define usart5_write(data, len)          usart_write(&USART5_port, data, len)
+#define usart5_try_send(c)               usart_try_send(&USART5_port, c)
+#define usart5_try_write(data, len)      usart_try_write(&USART5_port, data, len)
+#define usart5_tx_free()                 usart_tx_free(&USART5_port)
+#define usart5_tx_reserve(data)          usart_tx_reserve(&USART5_port, data)
+#define usart5_tx_commit(len)            usart_tx_commit(&USART5_port, len)
+#define usart5_set_tx_hook(level, hook)  usart_set_tx_hook(&USART5_port, level, hook)
+#define usart5_set_stream_mode(mode)     usart_set_stream_mode(&USART5_port, mode)
+#define usart5_read_char()               usart_read_char(&USART5_port)
+#define usart5_rx_peek(data)             usart_rx_peek(&USART5_port, data)
+#define usart5_rx_commit(len)            usart_rx_commit(&USART5_port, len)
+#define usart5_set_rx_policy(policy)     usart_set_rx_policy(&USART5_port, policy)
+#define usart5_rx_resume()               usart_rx_resume(&USART5_port)
+#define usart5_set_address(addr, bcast)  usart_set_address(&USART5_port, addr, bcast)
+#define usart5_clear_address()           usart_clear_address(&USART5_port)
+#define usart5_send_address(addr)        usart_send_address(&USART5_port, addr)
+#define usart5_close()                   usart_close(&USART5_port)
+#define usart5_close_async(hook)         usart_close_async(&USART5_port, hook)
+#define usart5_closing()                 usart_closing(&USART5_port)
+#define usart5_set_frame(mode, v, hook)  usart_set_frame(&USART5_port, mode, v, hook)
+#define usart5_frames()                  usart_frames(&USART5_port)
+#define usart5_frame_time()              usart_frame_time(&USART5_port)
+#define usart5_read_frame(buf, size, e)  usart_read_frame(&USART5_port, buf, size, e)
+#define usart5_autobaud(method, ms)      usart_autobaud(&USART5_port, method, ms)
+#define usart5_get_stats(stats)          usart_get_stats(&USART5_port, stats)
+#define usart5_reset_stats()             usart_reset_stats(&USART5_port)
 #endif
\ No newline at end of file
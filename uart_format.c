@@ -0,0 +1,118 @@
+/*
+ *     uart_format.c
+ *
+ *          Project:  UART for ATmega4808
+ *          Author:   Hans-Henrik Fuxelius   
+ *          Date:     2023-05-08           
+ */
+
+#include <avr/pgmspace.h>
+#include <stdbool.h>
+#include <string.h>
+#include "uart_format.h"
+
+#define USART_FORMAT_DIGITS  12                 // Sign, 10 digits and a decimal point
+
+static const char usart_hex_digits[16] = "0123456789ABCDEF";
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// STRINGS
+void usart_put_str(usart_port* port, const char* str) {
+	usart_write(port, str, strlen(str));
+}
+
+// Copied out of flash in stack sized pieces
+void usart_put_str_P(usart_port* port, const char* str) {
+	char buf[16];
+	size_t n;
+	do {
+		for (n = 0; n < sizeof(buf) && (buf[n] = pgm_read_byte(str + n)); n++) {
+		}
+		usart_write(port, buf, n);
+		str += n;
+	} while (n == sizeof(buf));
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// INTEGERS
+// Digits are produced from the end of buf backwards; 16 bit values take the
+// cheaper 16 bit division
+static char* usart_format_u16(char* end, uint16_t value) {
+	do {
+		*--end = '0' + value % 10;
+		value /= 10;
+	} while (value);
+	return end;
+}
+
+// decimals > 0 puts a point that many digits from the right, with leading zeros
+static char* usart_format_u32(char* end, uint32_t value, uint8_t decimals) {
+	char* point = end - decimals;
+	while (value > 0xFFFF || decimals) {
+		*--end = '0' + value % 10;
+		value /= 10;
+		if (end == point) {
+			*--end = '.';
+			decimals = 0;
+		}
+	}
+	return usart_format_u16(end, (uint16_t)value);
+}
+
+static void usart_put_number(usart_port* port, uint32_t value, bool negative, uint8_t decimals) {
+	char buf[USART_FORMAT_DIGITS];
+	char* end = buf + sizeof(buf);
+	char* start = usart_format_u32(end, value, decimals);
+	if (negative) {
+		*--start = '-';
+	}
+	usart_write(port, start, end - start);
+}
+
+void usart_put_u16(usart_port* port, uint16_t value) {
+	char buf[5];
+	char* end = buf + sizeof(buf);
+	char* start = usart_format_u16(end, value);
+	usart_write(port, start, end - start);
+}
+
+void usart_put_i16(usart_port* port, int16_t value) {
+	char buf[6];
+	char* end = buf + sizeof(buf);
+	char* start = usart_format_u16(end, (value < 0) ? -(uint16_t)value : (uint16_t)value);
+	if (value < 0) {
+		*--start = '-';
+	}
+	usart_write(port, start, end - start);
+}
+
+void usart_put_u32(usart_port* port, uint32_t value) {
+	usart_put_number(port, value, false, 0);
+}
+
+void usart_put_i32(usart_port* port, int32_t value) {
+	usart_put_number(port, (value < 0) ? -(uint32_t)value : (uint32_t)value, value < 0, 0);
+}
+
+// At most 9 decimals
+void usart_put_fixed(usart_port* port, int32_t value, uint8_t decimals) {
+	if (decimals > 9) {
+		decimals = 9;
+	}
+	usart_put_number(port, (value < 0) ? -(uint32_t)value : (uint32_t)value, value < 0, decimals);
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// HEX
+void usart_put_hex8(usart_port* port, uint8_t value) {
+	char buf[2] = { usart_hex_digits[value >> 4], usart_hex_digits[value & 0x0F] };
+	usart_write(port, buf, sizeof(buf));
+}
+
+void usart_put_hex16(usart_port* port, uint16_t value) {
+	char buf[4] = {
+		usart_hex_digits[value >> 12], usart_hex_digits[(value >> 8) & 0x0F],
+		usart_hex_digits[(value >> 4) & 0x0F], usart_hex_digits[value & 0x0F]
+	};
+	usart_write(port, buf, sizeof(buf));
+}
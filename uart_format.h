@@ -0,0 +1,27 @@
+/*
+ *     uart_format.h
+ *
+ *          Project:  UART for ATmega4808
+ *          Author:   Hans-Henrik Fuxelius   
+ *          Date:     2023-05-08           
+ */
+
+#pragma once
+#include <stdint.h>
+#include "uart.h"
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// DIRECT FORMATTING
+// Each call formats into a few bytes on the stack and hands them to the TX
+// ring with one usart_write, so the ring index and DREIE are touched once per
+// field instead of once per character as through USARTn_stream. Nothing here
+// pulls in vfprintf; the stream stays available alongside.
+void usart_put_str(usart_port* port, const char* str);
+void usart_put_str_P(usart_port* port, const char* str);     // String in flash (PSTR)
+void usart_put_u16(usart_port* port, uint16_t value);
+void usart_put_i16(usart_port* port, int16_t value);
+void usart_put_u32(usart_port* port, uint32_t value);
+void usart_put_i32(usart_port* port, int32_t value);
+void usart_put_hex8(usart_port* port, uint8_t value);        // Two upper case digits
+void usart_put_hex16(usart_port* port, uint16_t value);      // Four upper case digits
+void usart_put_fixed(usart_port* port, int32_t value, uint8_t decimals);   // 1234, 2 gives 12.34
@@ -0,0 +1,217 @@
+/*
+ *     uart_framing.c
+ *
+ *          Project:  UART for ATmega4808
+ *          Author:   Hans-Henrik Fuxelius   
+ *          Date:     2023-05-08           
+ */
+
+#include <avr/pgmspace.h>
+#include <stdbool.h>
+#include <string.h>
+#include "uart_framing.h"
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// CRC16
+// One table lookup per byte instead of eight shift and xor steps; the table
+// lives in flash and costs 512 bytes of it
+static const uint16_t usart_crc16_table[256] PROGMEM = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+	0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+	0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+	0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+	0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+	0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+	0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+	0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+	0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+	0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+	0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+	0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+	0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+	0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+	0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+	0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+	0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+	0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+	0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+	0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+	0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+	0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+	0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+	0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+	0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+	0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+	0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+	0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+	0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+	0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+	0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
+
+static inline uint16_t usart_crc16_byte(uint16_t crc, uint8_t c) {
+	return (uint16_t)(crc << 8) ^ pgm_read_word(&usart_crc16_table[(uint8_t)(crc >> 8) ^ c]);
+}
+
+uint16_t usart_crc16(uint16_t crc, const void* data, size_t len) {
+	const uint8_t* src = data;
+	while (len--) {
+		crc = usart_crc16_byte(crc, *src++);
+	}
+	return crc;
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// SLIP ENCODER
+// Bytes are escaped straight into the contiguous free span of the TX ring and
+// published once per span. With less than an escape pair of room left, one
+// byte goes through usart_send_char, which waits for the transmitter.
+static void usart_slip_put(usart_port* port, const uint8_t* src, size_t len, uint16_t* crc) {
+	while (len) {
+		char* dst;
+		size_t space = usart_tx_reserve(port, &dst);
+		size_t n = 0;
+
+		if (space < 2) {
+			uint8_t c = *src++;
+			len--;
+			if (crc) {
+				*crc = usart_crc16_byte(*crc, c);
+			}
+			if (c == USART_SLIP_END || c == USART_SLIP_ESC) {
+				usart_send_char(port, USART_SLIP_ESC);
+				c = (c == USART_SLIP_END) ? USART_SLIP_ESC_END : USART_SLIP_ESC_ESC;
+			}
+			usart_send_char(port, c);
+			continue;
+		}
+		while (len && n + 2 <= space) {
+			uint8_t c = *src++;
+			len--;
+			if (crc) {
+				*crc = usart_crc16_byte(*crc, c);
+			}
+			if (c == USART_SLIP_END) {
+				dst[n++] = USART_SLIP_ESC;
+				c = USART_SLIP_ESC_END;
+			}
+			else if (c == USART_SLIP_ESC) {
+				dst[n++] = USART_SLIP_ESC;
+				c = USART_SLIP_ESC_ESC;
+			}
+			dst[n++] = c;
+		}
+		usart_tx_commit(port, n);
+	}
+}
+
+// The leading END ends any line noise received before the frame
+void usart_slip_begin(usart_slip_tx* tx, usart_port* port) {
+	tx->port = port;
+	tx->crc = USART_CRC16_INIT;
+	usart_send_char(port, USART_SLIP_END);
+}
+
+void usart_slip_append(usart_slip_tx* tx, const void* data, size_t len) {
+	usart_slip_put(tx->port, data, len, &tx->crc);
+}
+
+void usart_slip_end(usart_slip_tx* tx) {
+	uint8_t crc[2] = { tx->crc >> 8, tx->crc & 0xFF };
+	usart_slip_put(tx->port, crc, sizeof(crc), NULL);
+	usart_send_char(tx->port, USART_SLIP_END);
+}
+
+void usart_slip_send(usart_port* port, const void* data, size_t len) {
+	usart_slip_tx tx;
+	usart_slip_begin(&tx, port);
+	usart_slip_append(&tx, data, len);
+	usart_slip_end(&tx);
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// SLIP DECODER
+// Unflagged spans are decoded in place in the RX ring and committed once per
+// span; a byte the driver flagged as damaged is read on its own and spoils
+// the frame it belongs to. The CRC runs along as bytes are stored.
+void usart_slip_rx_init(usart_slip_rx* rx, void* buf, size_t size) {
+	memset(rx, 0, sizeof(*rx));
+	rx->buf = buf;
+	rx->size = size;
+	rx->crc = USART_CRC16_INIT;
+}
+
+// Feeds one byte; true when it ended a good frame
+static bool usart_slip_byte(usart_slip_rx* rx, uint8_t c) {
+	if (c == USART_SLIP_END) {
+		bool good = rx->len > 2 && !rx->bad && !rx->escape && rx->crc == 0;
+		if (!good && (rx->len || rx->bad)) {
+			rx->dropped++;
+		}
+		rx->done = good;
+		if (!good) {
+			rx->len = 0;
+		}
+		rx->crc = USART_CRC16_INIT;
+		rx->escape = false;
+		rx->bad = false;
+		return good;
+	}
+	if (c == USART_SLIP_ESC) {
+		rx->escape = true;
+		return false;
+	}
+	if (rx->escape) {
+		rx->escape = false;
+		if (c == USART_SLIP_ESC_END) {
+			c = USART_SLIP_END;
+		}
+		else if (c == USART_SLIP_ESC_ESC) {
+			c = USART_SLIP_ESC;
+		}
+		else {
+			rx->bad = true;							// Invalid escape
+		}
+	}
+	if (rx->len < rx->size) {
+		rx->buf[rx->len++] = c;
+		rx->crc = usart_crc16_byte(rx->crc, c);
+	}
+	else {
+		rx->bad = true;								// Frame longer than buf
+	}
+	return false;
+}
+
+// Decodes what the RX ring holds up to the end of the next good frame. Returns
+// its payload length with the payload in buf, valid until the next call, or 0
+// if no frame is complete yet. Frames must carry at least one payload byte.
+size_t usart_slip_receive(usart_slip_rx* rx, usart_port* port) {
+	if (rx->done) {
+		rx->done = false;
+		rx->len = 0;
+	}
+	for (;;) {
+		const char* data;
+		size_t n = usart_rx_peek(port, &data);
+		if (!n) {
+			uint16_t c = usart_read_char(port);
+			if (c & USART_NO_DATA) {
+				return 0;
+			}
+			rx->bad = true;							// Damaged, or data lost before it
+			if (usart_slip_byte(rx, (uint8_t)c)) {
+				return rx->len - 2;
+			}
+			continue;
+		}
+		for (size_t i = 0; i < n; i++) {
+			if (usart_slip_byte(rx, (uint8_t)data[i])) {
+				usart_rx_commit(port, i + 1);
+				return rx->len - 2;
+			}
+		}
+		usart_rx_commit(port, n);
+	}
+}
@@ -0,0 +1,55 @@
+/*
+ *     uart_framing.h
+ *
+ *          Project:  UART for ATmega4808
+ *          Author:   Hans-Henrik Fuxelius   
+ *          Date:     2023-05-08           
+ */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "uart.h"
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// SLIP FRAMING WITH CRC16
+// Frames are SLIP (RFC 1055): END, payload, CRC16, END, with END and ESC bytes
+// inside escaped. The CRC is CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF)
+// over the payload, sent high byte first, so the CRC over payload and CRC is
+// zero. Encoding writes straight into the TX ring and decoding reads straight
+// from the RX ring, both through the driver's zero-copy calls.
+#define USART_SLIP_END           0xC0
+#define USART_SLIP_ESC           0xDB
+#define USART_SLIP_ESC_END       0xDC        // ESC ESC_END stands for END
+#define USART_SLIP_ESC_ESC       0xDD        // ESC ESC_ESC stands for ESC
+
+#define USART_CRC16_INIT         0xFFFF
+
+uint16_t usart_crc16(uint16_t crc, const void* data, size_t len);
+
+// Encoder; a frame may be built from any number of appends
+typedef struct {
+    usart_port*  port;
+    uint16_t     crc;
+} usart_slip_tx;
+
+void usart_slip_begin(usart_slip_tx* tx, usart_port* port);
+void usart_slip_append(usart_slip_tx* tx, const void* data, size_t len);   // Blocks while the TX ring is full
+void usart_slip_end(usart_slip_tx* tx);
+void usart_slip_send(usart_port* port, const void* data, size_t len);      // Whole frame in one call
+
+// Decoder; keeps its state between calls, so it can be polled as data arrives
+typedef struct {
+    uint8_t*     buf;                        // Payload and CRC of the frame being received
+    size_t       size;
+    size_t       len;
+    uint16_t     crc;
+    bool         escape;                     // Last byte was ESC
+    bool         bad;                        // Frame is dropped at its END
+    bool         done;                       // buf holds a complete frame
+    uint16_t     dropped;                    // Frames dropped for CRC, size, escape or line errors
+} usart_slip_rx;
+
+void usart_slip_rx_init(usart_slip_rx* rx, void* buf, size_t size);       // size includes the 2 CRC bytes
+size_t usart_slip_receive(usart_slip_rx* rx, usart_port* port);           // Payload length of a good frame, else 0
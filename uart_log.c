@@ -0,0 +1,38 @@
+/*
+ *     uart_log.c
+ *
+ *          Project:  UART for ATmega4808
+ *          Author:   Hans-Henrik Fuxelius   
+ *          Date:     2023-05-08           
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "uart_log.h"
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// RECORD
+// The format address is the record id; AVR pointers into flash are 16 bit
+void usart_log_begin(usart_slip_tx* tx, usart_port* port, const char* fmt) {
+	uint16_t id = (uint16_t)(uintptr_t)fmt;
+	uint8_t bytes[2] = { id & 0xFF, id >> 8 };
+	usart_slip_begin(tx, port);
+	usart_slip_append(tx, bytes, sizeof(bytes));
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// ARGUMENTS; little endian, as the AVR keeps them in memory
+void usart_log_int(usart_slip_tx* tx, uint32_t value, uint8_t size) {
+	uint8_t bytes[4] = { value, value >> 8, value >> 16, value >> 24 };
+	usart_slip_append(tx, bytes, size);
+}
+
+void usart_log_float(usart_slip_tx* tx, float value, uint8_t size) {
+	uint8_t bytes[4];
+	memcpy(bytes, &value, sizeof(bytes));
+	usart_slip_append(tx, bytes, sizeof(bytes));
+}
+
+void usart_log_str(usart_slip_tx* tx, const char* str, uint8_t size) {
+	usart_slip_append(tx, str, strlen(str) + 1);
+}
@@ -0,0 +1,55 @@
+/*
+ *     uart_log.h
+ *
+ *          Project:  UART for ATmega4808
+ *          Author:   Hans-Henrik Fuxelius   
+ *          Date:     2023-05-08           
+ */
+
+#pragma once
+#include <stdint.h>
+#include "uart_framing.h"
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// DEFERRED LOGGING
+// USART_LOG(port, fmt, ...) sends a record in place of formatted text: a SLIP
+// frame holding the flash address of fmt (2 bytes, little endian) followed by
+// the raw arguments. tools/ulog_decode.py finds fmt through that address in
+// the firmware ELF and does the formatting on the host.
+//
+// Arguments are packed as printf on AVR takes them, so the format says how
+// many bytes each has: 2 for int sized and smaller integers, 4 for long and
+// for float or double, and a NUL terminated copy for char*. At most 8
+// arguments; every fmt is a separate string in flash.
+#define USART_LOG(port, fmt, ...) do { \
+	static const char usart_log_fmt[] __attribute__((section(".progmem.ulog"), used)) = fmt; \
+	usart_slip_tx usart_log_tx; \
+	usart_log_begin(&usart_log_tx, port, usart_log_fmt); \
+	USART_LOG_ARGS(&usart_log_tx, ##__VA_ARGS__) \
+	usart_slip_end(&usart_log_tx); \
+} while (0)
+
+#define USART_LOG_ARG(tx, x)  _Generic((x), \
+	char*: usart_log_str, const char*: usart_log_str, \
+	float: usart_log_float, double: usart_log_float, \
+	default: usart_log_int)(tx, x, (sizeof((x) + 0) <= sizeof(int)) ? 2 : 4)
+
+#define USART_LOG_COUNT(...)     USART_LOG_COUNT_(_, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define USART_LOG_COUNT_(_, a1, a2, a3, a4, a5, a6, a7, a8, n, ...)  n
+#define USART_LOG_CAT(a, b)      USART_LOG_CAT_(a, b)
+#define USART_LOG_CAT_(a, b)     a##b
+#define USART_LOG_ARGS(tx, ...)  USART_LOG_CAT(USART_LOG_ARGS_, USART_LOG_COUNT(__VA_ARGS__))(tx, ##__VA_ARGS__)
+#define USART_LOG_ARGS_0(tx)
+#define USART_LOG_ARGS_1(tx, a)       USART_LOG_ARG(tx, a);
+#define USART_LOG_ARGS_2(tx, a, ...)  USART_LOG_ARG(tx, a); USART_LOG_ARGS_1(tx, __VA_ARGS__)
+#define USART_LOG_ARGS_3(tx, a, ...)  USART_LOG_ARG(tx, a); USART_LOG_ARGS_2(tx, __VA_ARGS__)
+#define USART_LOG_ARGS_4(tx, a, ...)  USART_LOG_ARG(tx, a); USART_LOG_ARGS_3(tx, __VA_ARGS__)
+#define USART_LOG_ARGS_5(tx, a, ...)  USART_LOG_ARG(tx, a); USART_LOG_ARGS_4(tx, __VA_ARGS__)
+#define USART_LOG_ARGS_6(tx, a, ...)  USART_LOG_ARG(tx, a); USART_LOG_ARGS_5(tx, __VA_ARGS__)
+#define USART_LOG_ARGS_7(tx, a, ...)  USART_LOG_ARG(tx, a); USART_LOG_ARGS_6(tx, __VA_ARGS__)
+#define USART_LOG_ARGS_8(tx, a, ...)  USART_LOG_ARG(tx, a); USART_LOG_ARGS_7(tx, __VA_ARGS__)
+
+void usart_log_begin(usart_slip_tx* tx, usart_port* port, const char* fmt);
+void usart_log_int(usart_slip_tx* tx, uint32_t value, uint8_t size);
+void usart_log_float(usart_slip_tx* tx, float value, uint8_t size);
+void usart_log_str(usart_slip_tx* tx, const char* str, uint8_t size);
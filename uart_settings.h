@@ -8,40 +8,164 @@
 
 
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-// DEFINE RING BUFFER SIZE; must be 2, 4, 8, 16, 32, 64 or 128  
+// DEFINE RING BUFFER SIZES; must be a power of two from 2 to 2048
+// RBUFFER_SIZE is used for every ring not given its own size below. Ring
+// indices widen from 8 to 16 bits only if an enabled port uses more than 128.
+#ifndef RBUFFER_SIZE
 #define RBUFFER_SIZE 32  
+#endif
+
+// #define USART0_RX_BUFFER_SIZE 32
+// #define USART0_TX_BUFFER_SIZE 32
+// #define USART3_RX_BUFFER_SIZE 256
+// #define USART3_TX_BUFFER_SIZE 64
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// BAUD RATE TOLERANCE; USART_CONFIG fails the build above this error (permille)
+#define USART_BAUD_TOLERANCE 20
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// ISR FAST PATH
+// Inline the RXC and DRE handlers into each enabled vector. Costs flash for
+// every enabled port but removes the call and the address loads. Time in a
+// handler is one entry plus up to two bytes moved; keep the sum over all
+// active handlers below one character time at the fastest baud rate.
+//
+// Typical-path estimates, counted by hand from the C against the AVRxt
+// instruction timings for an optimized build (-Os or -O2; the Makefile's -Og
+// inlines less). They cover plain bytes with 8-bit ring indices and no
+// statistics. Entry + exit includes saving every call-clobbered register,
+// which avr-gcc does because each vector keeps calls to its slow paths.
+// Errors, full rings, frames, address frames and hooks take those slow paths
+// and cost more; so do 16-bit indices.
+//
+//                        entry + exit   per byte   two bytes
+//     RXC  inlined            60           45         150
+//     RXC  out-of-line        89           55         199
+//     DRE  inlined            64           30         124
+//     DRE  out-of-line        95           30         155
+//
+// A full-duplex port moving one byte per interrupt costs about 199 cycles per
+// character inlined and 269 out-of-line. With 10-bit characters N such ports
+// stay within budget up to about F_CPU / 20 / N baud inlined and F_CPU / 27 / N
+// out-of-line: 133000 / N and 99000 / N baud at the default 2.67 MHz.
+// #define USART_ISR_FASTPATH
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// FLAGGED BYTES
+// Bytes with a parity or frame error, or after lost data, each port can hold
+// unread; a power of two from 2 to 128. One more such byte is dropped and the
+// loss flagged on the next one stored.
+#define USART_RX_MARKS 4
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// STATISTICS
+// Per-port byte, drop, error and ring high-water counters; see usart_get_stats
+// #define USART_STATS_ENABLE
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// FRAME ASSEMBLER
+// Complete frames each port can queue, see usart_set_frame; a power of two
+// from 2 to 8. Comment out to compile the assembler out.
+#define USART_FRAME_QUEUE 4
+
+// Read when a frame is queued, see usart_frame_time. RTC.CNT reads 0 unless
+// the application runs the RTC.
+#define USART_TIMESTAMP()  (RTC.CNT)
+
+// TCB per port timing the silence that ends a USART_FRAME_GAP frame; the
+// driver owns its vector. Not the USART_TIMER unit; leave out if unused.
+// #define USART0_GAP_TIMER       TCB0
+// #define USART0_GAP_TIMER_vect  TCB0_INT_vect
+// #define USART3_GAP_TIMER       TCB2
+// #define USART3_GAP_TIMER_vect  TCB2_INT_vect
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// DRIVER TIMER
+// TCB used by blocking helpers such as usart_autobaud and usart_wait_any for
+// timeouts and edge timing. It is only touched while such a helper runs, but
+// the driver owns its vector; comment out both to drop the helpers.
+#define USART_TIMER TCB1
+#define USART_TIMER_vect TCB1_INT_vect
 
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
 // ENABLE USART UNITS
+// A build can pass USART_ENABLE_MASK instead, bit n enabling USARTn, as
+// `make size-ports` does; the list below is then ignored.
+#ifdef USART_ENABLE_MASK
+#if USART_ENABLE_MASK & 0x01
+#define USART0_ENABLE
+#endif
+#if USART_ENABLE_MASK & 0x02
+#define USART1_ENABLE
+#endif
+#if USART_ENABLE_MASK & 0x04
+#define USART2_ENABLE
+#endif
+#if USART_ENABLE_MASK & 0x08
+#define USART3_ENABLE
+#endif
+#if USART_ENABLE_MASK & 0x10
+#define USART4_ENABLE
+#endif
+#if USART_ENABLE_MASK & 0x20
+#define USART5_ENABLE
+#endif
+#else
 // #define USART0_ENABLE
 // #define USART1_ENABLE
 // #define USART2_ENABLE
 #define USART3_ENABLE
 // #define USART4_ENABLE
 // #define USART5_ENABLE
+#endif
 
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
 // PORTMUX & PINOUT
 #ifdef USART0_ENABLE
 void usart0_port_init(void);
+#define USART0_RX_PORT          PORTA           // Rx pin as routed by usart0_port_init,
+#define USART0_RX_PIN_bm        PIN1_bm         // read by software auto-baud
+#define USART0_XDIR_PORT        PORTA           // XDIR pin as routed by usart0_port_init,
+#define USART0_XDIR_PIN_bm      PIN3_bm         // driven with USART_OPTION_RS485
 #endif
 
 #ifdef USART1_ENABLE
 void usart1_port_init(void);
+#define USART1_RX_PORT          PORTC           // Rx pin as routed by usart1_port_init,
+#define USART1_RX_PIN_bm        PIN1_bm         // read by software auto-baud
+#define USART1_XDIR_PORT        PORTC           // XDIR pin as routed by usart1_port_init,
+#define USART1_XDIR_PIN_bm      PIN3_bm         // driven with USART_OPTION_RS485
 #endif
 
 #ifdef USART2_ENABLE
 void usart2_port_init(void);
+#define USART2_RX_PORT          PORTF           // Rx pin as routed by usart2_port_init,
+#define USART2_RX_PIN_bm        PIN1_bm         // read by software auto-baud
+#define USART2_XDIR_PORT        PORTF           // XDIR pin as routed by usart2_port_init,
+#define USART2_XDIR_PIN_bm      PIN3_bm         // driven with USART_OPTION_RS485
 #endif
 
 #ifdef USART3_ENABLE
 void usart3_port_init(void);
+#define USART3_RX_PORT          PORTB           // Rx pin as routed by usart3_port_init,
+#define USART3_RX_PIN_bm        PIN5_bm         // read by software auto-baud
+#define USART3_XDIR_PORT        PORTB           // XDIR pin as routed by usart3_port_init,
+#define USART3_XDIR_PIN_bm      PIN7_bm         // driven with USART_OPTION_RS485
 #endif
 
 #ifdef USART4_ENABLE
 void usart4_port_init(void);
+#define USART4_RX_PORT          PORTE           // Rx pin as routed by usart4_port_init,
+#define USART4_RX_PIN_bm        PIN1_bm         // read by software auto-baud
+#define USART4_XDIR_PORT        PORTE           // XDIR pin as routed by usart4_port_init,
+#define USART4_XDIR_PIN_bm      PIN3_bm         // driven with USART_OPTION_RS485
 #endif
 
 #ifdef USART5_ENABLE
 void usart5_port_init(void);
+#define USART5_RX_PORT          PORTG           // Rx pin as routed by usart5_port_init,
+#define USART5_RX_PIN_bm        PIN1_bm         // read by software auto-baud
+#define USART5_XDIR_PORT        PORTG           // XDIR pin as routed by usart5_port_init,
+#define USART5_XDIR_PIN_bm      PIN3_bm         // driven with USART_OPTION_RS485
 #endif
\ No newline at end of file